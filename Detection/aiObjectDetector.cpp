@@ -2,5 +2,5 @@
 
 AIObjectDetector::AIObjectDetector() {}
 AIObjectDetector::~AIObjectDetector() {}
-bool AIObjectDetector::configuration(DetectionConfigurationParameter parameters, PartitionDetectionConfigurationParameter partitionParameter) {}
-bool AIObjectDetector::detect(cv::Mat &image, std::map<int,std::vector<std::pair<cv::Rect,float>>> &objectInfoList, int &objectCount) {}
+bool AIObjectDetector::configuration(DetectionConfigurationParameter parameters, PartitionDetectionConfigurationParameter partitionParameter) { return false; }
+bool AIObjectDetector::detect(cv::Mat &image, std::map<int,std::vector<std::pair<cv::Rect,float>>> &objectInfoList, int &objectCount) { return false; }
@@ -25,6 +25,14 @@ bool ColorInRangeDetection::configuration(ColorConfigurationParameters parameter
 
 }
 
+bool ColorInRangeDetection::setImageScale(int scale)
+{
+    if (scale < 1)
+        return false;
+    imageScale = scale;
+    return true;
+}
+
 bool ColorInRangeDetection::detect(cv::Mat &image, int &noOfObject, std::vector<cv::Rect> &boundingBox)
 {
     try {
@@ -40,8 +48,11 @@ bool ColorInRangeDetection::detect(cv::Mat &image, int &noOfObject, std::vector<
         ret.areaFactor = 0.0;
         ret.maskedImage = cv::Mat::zeros(image_hight, image_width, CV_8UC3);
 
+        StageMetrics::ScopedTimer convertTimer(StageMetrics::ColorConvert);
         cvtColor(image, HSV_image, cv::COLOR_RGB2HSV_FULL);
+        convertTimer.stop();
 
+        StageMetrics::ScopedTimer thresholdTimer(StageMetrics::ColorThreshold);
         cv::Mat mask_combined(image_hight, image_width, CV_8UC1, cv::Scalar(0));
         for (size_t i = 0; i < parameter.colorRanges.size(); i++) {
             cv::Mat mask;
@@ -50,7 +61,9 @@ bool ColorInRangeDetection::detect(cv::Mat &image, int &noOfObject, std::vector<
             mask_combined=mask_combined|mask;
         }
         cv::morphologyEx(mask_combined, mask_combined, cv::MORPH_CLOSE, getStructuringElement(cv::MORPH_RECT, cv::Size(4, 4)));
+        thresholdTimer.stop();
 
+        StageMetrics::ScopedTimer contoursTimer(StageMetrics::ColorContours);
         findContours(mask_combined, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
         
         for (size_t i = 0; i < contours.size(); i++)
@@ -61,13 +74,14 @@ bool ColorInRangeDetection::detect(cv::Mat &image, int &noOfObject, std::vector<
             drawContours(ret.maskedImage, contours, i, contour_color, cv::FILLED, 8);
 
             double area = contourArea(contours[i], false);
+            const double fullArea = area * imageScale * imageScale;
 
-            if (parameter.maxContourSize >= area && parameter.minContourSize <= area)
+            if (parameter.maxContourSize >= fullArea && parameter.minContourSize <= fullArea)
             {
                 int ar = static_cast<int>(area);
                 cv::putText(ret.maskedImage, std::to_string(ar), contours[i][contours[i].size() / 2], cv::FONT_HERSHEY_SIMPLEX, 1.2, font_color, 2);
                 bounding_rect = boundingRect(contours[i]);
-                if (bounding_rect.width >= widthPix && bounding_rect.height > heightPix)
+                if (bounding_rect.width * imageScale >= widthPix && bounding_rect.height * imageScale > heightPix)
                 {
                     totalArea += area;
                     boundingBox.push_back(bounding_rect);
@@ -1,8 +1,11 @@
 #include "detectionLibrary.H"
 
 DetectionLibrary::DetectionLibrary() {}
-bool DetectionLibrary::configuration(DetectionConfigurationParameter parameters, PartitionDetectionConfigurationParameter partitionParameter){}
-bool DetectionLibrary::configuration(ColorConfigurationParameters parameters, PartitionDetectionConfigurationParameter partitionParameter, int height, int width) {}
-bool DetectionLibrary::detect(cv::Mat &image, std::map<int,std::vector<std::pair<cv::Rect,float>>> &objectInfoList, int &objectCount) {}
-bool DetectionLibrary::detect(cv::Mat &image, int &noOfObject, std::vector<cv::Rect> &boundingBox) {}
+bool DetectionLibrary::configuration(DetectionConfigurationParameter parameters, PartitionDetectionConfigurationParameter partitionParameter) { return false; }
+bool DetectionLibrary::configuration(ColorConfigurationParameters parameters, PartitionDetectionConfigurationParameter partitionParameter, int height, int width) { return false; }
+bool DetectionLibrary::detect(cv::Mat &image, std::map<int,std::vector<std::pair<cv::Rect,float>>> &objectInfoList, int &objectCount) { return false; }
+bool DetectionLibrary::detect(cv::Mat &image, int &noOfObject, std::vector<cv::Rect> &boundingBox) { return false; }
+bool DetectionLibrary::setDegradedMode(bool degraded) { return false; }
+bool DetectionLibrary::setPreprocessCache(PreprocessCache *cache) { return false; }
+bool DetectionLibrary::setImageScale(int scale) { return scale == 1; }
 DetectionLibrary::~DetectionLibrary() {}
@@ -6,9 +6,17 @@ DetectionLibrary *detectionSelector::generateDetection(DetectionType type)
     switch (type)
     {
     case ObjectDetector:
+#ifdef DETECTION_WITH_DARKNET
         return new Yolo();
+#else
+        return nullptr;
+#endif
     case onnx:
+#ifdef DETECTION_WITH_OPENCV_DNN
         return new Onnx();
+#else
+        return nullptr;
+#endif
     case InRangeDetection:
         return new ColorInRangeDetection();
     case RegionGrow:
@@ -1,5 +1,219 @@
 #include "onnx.H"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <set>
+
+namespace
+{
+    /**
+     * @brief Just enough of the protobuf wire format to walk an ONNX ModelProto.
+     */
+    class ProtoReader
+    {
+    public:
+        ProtoReader(const uint8_t *data, size_t size) : position(data), end(data + size) {}
+
+        /** @brief Next field, false at the end or on malformed input. */
+        bool next(uint32_t &field, uint32_t &wireType)
+        {
+            uint64_t key;
+            if (position >= end || !varint(key))
+                return false;
+            field = static_cast<uint32_t>(key >> 3);
+            wireType = static_cast<uint32_t>(key & 7);
+            return true;
+        }
+
+        bool varint(uint64_t &value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64 && position < end; shift += 7)
+            {
+                const uint8_t byte = *position++;
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        bool bytes(ProtoReader &message)
+        {
+            uint64_t length;
+            if (!varint(length) || length > static_cast<uint64_t>(end - position))
+                return false;
+            message = ProtoReader(position, length);
+            position += length;
+            return true;
+        }
+
+        std::string string()
+        {
+            ProtoReader text(nullptr, 0);
+            return bytes(text) ? std::string(reinterpret_cast<const char *>(text.position), text.end - text.position) : std::string();
+        }
+
+        bool skip(uint32_t wireType)
+        {
+            uint64_t value;
+            ProtoReader message(nullptr, 0);
+            switch (wireType)
+            {
+            case 0:
+                return varint(value);
+            case 1:
+                return advance(8);
+            case 2:
+                return bytes(message);
+            case 5:
+                return advance(4);
+            default:
+                return false;
+            }
+        }
+
+    private:
+        bool advance(size_t count)
+        {
+            if (count > static_cast<size_t>(end - position))
+                return false;
+            position += count;
+            return true;
+        }
+
+        const uint8_t *position;
+        const uint8_t *end;
+    };
+
+    // ONNX field numbers.
+    constexpr uint32_t ModelGraph = 7;
+    constexpr uint32_t GraphInitializer = 5, GraphInput = 11;
+    constexpr uint32_t TensorName = 8;
+    constexpr uint32_t ValueInfoName = 1, ValueInfoType = 2;
+    constexpr uint32_t TypeTensor = 1, TensorTypeShape = 2, ShapeDim = 1, DimValue = 1;
+
+    /** @brief Dimensions of a ValueInfoProto, 0 for symbolic ones. */
+    bool valueInfoDims(ProtoReader info, std::string &name, std::vector<int64_t> &dims)
+    {
+        uint32_t field, wireType;
+        while (info.next(field, wireType))
+        {
+            ProtoReader type(nullptr, 0), tensor(nullptr, 0), shape(nullptr, 0);
+            if (field == ValueInfoName && wireType == 2)
+            {
+                name = info.string();
+            }
+            else if (field == ValueInfoType && wireType == 2 && info.bytes(type))
+            {
+                while (type.next(field, wireType))
+                {
+                    if (field != TypeTensor || wireType != 2 || !type.bytes(tensor))
+                    {
+                        if (!type.skip(wireType))
+                            return false;
+                        continue;
+                    }
+                    while (tensor.next(field, wireType))
+                    {
+                        if (field != TensorTypeShape || wireType != 2 || !tensor.bytes(shape))
+                        {
+                            if (!tensor.skip(wireType))
+                                return false;
+                            continue;
+                        }
+                        while (shape.next(field, wireType))
+                        {
+                            ProtoReader dim(nullptr, 0);
+                            if (field != ShapeDim || wireType != 2 || !shape.bytes(dim))
+                            {
+                                if (!shape.skip(wireType))
+                                    return false;
+                                continue;
+                            }
+                            int64_t value = 0;
+                            while (dim.next(field, wireType))
+                            {
+                                uint64_t raw;
+                                if (field == DimValue && wireType == 0 && dim.varint(raw))
+                                    value = static_cast<int64_t>(raw);
+                                else if (!dim.skip(wireType))
+                                    return false;
+                            }
+                            dims.push_back(value);
+                        }
+                    }
+                }
+            }
+            else if (!info.skip(wireType))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** @brief Dimensions of the first graph input that is not an initializer. */
+    bool graphInputDims(const std::vector<uint8_t> &model, std::vector<int64_t> &dims)
+    {
+        ProtoReader reader(model.data(), model.size());
+        ProtoReader graph(nullptr, 0);
+        uint32_t field, wireType;
+        bool foundGraph = false;
+        while (!foundGraph && reader.next(field, wireType))
+        {
+            if (field == ModelGraph && wireType == 2)
+                foundGraph = reader.bytes(graph);
+            else if (!reader.skip(wireType))
+                return false;
+        }
+        if (!foundGraph)
+            return false;
+
+        // Older exporters also list the initializers as graph inputs.
+        std::set<std::string> initializers;
+        std::vector<ProtoReader> inputs;
+        while (graph.next(field, wireType))
+        {
+            ProtoReader message(nullptr, 0);
+            if ((field == GraphInitializer || field == GraphInput) && wireType == 2 && graph.bytes(message))
+            {
+                if (field == GraphInput)
+                {
+                    inputs.push_back(message);
+                    continue;
+                }
+                uint32_t tensorField, tensorWire;
+                while (message.next(tensorField, tensorWire))
+                {
+                    if (tensorField == TensorName && tensorWire == 2)
+                        initializers.insert(message.string());
+                    else if (!message.skip(tensorWire))
+                        break;
+                }
+            }
+            else if (!graph.skip(wireType))
+            {
+                return false;
+            }
+        }
+
+        for (const ProtoReader &input : inputs)
+        {
+            std::string name;
+            std::vector<int64_t> inputDims;
+            if (valueInfoDims(input, name, inputDims) && !initializers.count(name))
+            {
+                dims = inputDims;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
 Onnx::Onnx() {}
 
 Onnx::~Onnx() {}
@@ -13,20 +227,57 @@ bool Onnx::configuration(DetectionConfigurationParameter parameters, PartitionDe
             errorDetails.errormsg = ".weight file not found";
             return false;
         }
-        net_ = cv::dnn::readNet(parameters.weightFile); //model file
-        net_.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA);
-        net_.setPreferableTarget(cv::dnn::DNN_TARGET_CUDA_FP16);
+
         std::ifstream nameFile(parameters.nameFile); //names file
         std::string name;
+        names.clear();
 
         while(std::getline(nameFile, name))
         {
             names.push_back(name);
         }
+        if (names.empty())
+        {
+            errorDetails.errorcode = FileNotFound;
+            errorDetails.errormsg = "names file not found or empty";
+            return false;
+        }
 
-        confidenceThreshold_=thresh;
-        threshHeir = parameters.thresh;
+        thresh = parameters.thresh;
         nms = parameters.nms;
+        // Scores are objectness * class probability, so no box with an objectness below thresh can pass.
+        if (thresh <= 0.f)
+            objectnessLogit_ = std::numeric_limits<float>::lowest();
+        else if (thresh >= 1.f)
+            objectnessLogit_ = std::numeric_limits<float>::max();
+        else
+            objectnessLogit_ = std::log(thresh / (1.f - thresh));
+
+        inputSize_ = cv::Size(parameters.inputWidth, parameters.inputHeight);
+        bool dynamicInput = false;
+        int batch = 0;
+        if (!readInputSize(parameters.weightFile, inputSize_, dynamicInput, batch))
+        {
+            return false;
+        }
+
+        net_ = cv::dnn::readNet(parameters.weightFile); //model file
+        if (!parameters.calibrationDirectory.empty() && !quantize(parameters.calibrationDirectory, parameters.calibrationImages, batch))
+        {
+            return false;
+        }
+        selectBackend();
+        if (!inspectOutputs(parameters.anchors))
+        {
+            return false;
+        }
+        fullInputSize_ = inputSize_;
+        fullGridOutputs_ = gridOutputs_;
+        degradedInputSize_ = cv::Size();
+        if (dynamicInput)
+        {
+            prepareDegradedInput(parameters.anchors);
+        }
 
         errorDetails.errorcode = NoError;
         errorDetails.errormsg = "";
@@ -43,64 +294,47 @@ bool Onnx::configuration(DetectionConfigurationParameter parameters, PartitionDe
 bool Onnx::detect(cv::Mat &image, std::map<int, std::vector<std::pair<cv::Rect, float>>> &objectInfoList, int &objectCount)
 {
     try{
-        cv::Mat blob;
-        int col = image.cols;
-        int row = image.rows;
-        int maxLen = MAX(col, row);
-        cv::Mat netInputImg = image.clone();
-        if (maxLen > 1.2 * col || maxLen > 1.2 * row) {
-            cv::Mat resizeImg = cv::Mat::zeros(maxLen, maxLen, CV_8UC3);
-            image.copyTo(resizeImg(cv::Rect(0, 0, col, row)));
-            netInputImg = resizeImg;
-        }
-        cv::dnn::blobFromImage(netInputImg, blob, 1 / 255.0, cv::Size(size_, size_), cv::Scalar(0, 0, 0), true, false);
-        net_.setInput(blob);
+        StageMetrics::ScopedTimer preprocessTimer(StageMetrics::OnnxPreprocess);
+        if (cache_ == &ownCache_)
+            ownCache_.newFrame();
+        Letterbox letterbox;
+        // setInput() copies the blob, so the shared buffer is only held while it is copied.
+        cache_->letterbox(image, inputSize_, [&](const cv::Mat &blob, const Letterbox &frameLetterbox)
+        {
+            net_.setInput(blob);
+            letterbox = frameLetterbox;
+        });
+        preprocessTimer.stop();
+
+        StageMetrics::ScopedTimer forwardTimer(StageMetrics::OnnxForward);
         std::vector<cv::Mat> netOutputImg;
-        net_.forward(netOutputImg, net_.getUnconnectedOutLayersNames());
+        net_.forward(netOutputImg, outputNames_);
+        forwardTimer.stop();
+
+        StageMetrics::ScopedTimer decodeTimer(StageMetrics::OnnxDecode);
 
         std::vector<int> classIds;//result id array
         std::vector<float> confidences;//As a result, each id corresponds to a confidence array
         std::vector<cv::Rect> boxes;//Each id rectangle
-        float ratio_h = (float)netInputImg.rows / size_;
-        float ratio_w = (float)netInputImg.cols / size_;
-        int net_width = names.size() + 5;  //The output network width is the number of categories+5
-        for (int stride = 0; stride < strideSize; stride++) {    //stride
-            float* pdata = (float*)netOutputImg[stride].data;
-            int grid_x = (int)(size_ / netStride[stride]);
-            int grid_y = (int)(size_ / netStride[stride]);
-            for (int anchor = 0; anchor < 3; anchor++) {	//anchors
-                const float anchor_w = netAnchors[stride][anchor * 2];
-                const float anchor_h = netAnchors[stride][anchor * 2 + 1];
-                for (int i = 0; i < grid_y; i++) {
-                    for (int j = 0; j < grid_x; j++) {
-                        float box_score = sigmoid_x(pdata[4]); ;//Get the probability that an object is contained in the box of each row
-                        if (box_score >= threshHeir) {
-                            cv::Mat scores(1, names.size(), CV_32FC1, pdata + 5);
-                            cv::Point classIdPoint;
-                            double max_class_socre;
-                            minMaxLoc(scores, 0, &max_class_socre, 0, &classIdPoint);
-                            max_class_socre = sigmoid_x(max_class_socre);
-                            if (max_class_socre >= confidenceThreshold_) {
-                                float x = (sigmoid_x(pdata[0]) * 2.f - 0.5f + j) * netStride[stride];  //x
-                                float y = (sigmoid_x(pdata[1]) * 2.f - 0.5f + i) * netStride[stride];   //y
-                                float w = powf(sigmoid_x(pdata[2]) * 2.f, 2.f) * anchor_w;   //w
-                                float h = powf(sigmoid_x(pdata[3]) * 2.f, 2.f) * anchor_h;  //h
-                                int left = (int)(x - 0.5 * w) * ratio_w + 0.5;
-                                int top = (int)(y - 0.5 * h) * ratio_h + 0.5;
-                                classIds.push_back(classIdPoint.x);
-                                confidences.push_back(max_class_socre * box_score);
-                                boxes.push_back(cv::Rect(left, top, int(w * ratio_w), int(h * ratio_h)));
-                            }
-                        }
-                        pdata += net_width;//next line
-                    }
-                }
-            }
+        switch (layout_)
+        {
+        case AnchorGrid:
+            decodeHead<AnchorGrid>(netOutputImg, letterbox, classIds, confidences, boxes);
+            break;
+        case AnchorConcat:
+            decodeHead<AnchorConcat>(netOutputImg, letterbox, classIds, confidences, boxes);
+            break;
+        case AnchorFree:
+            decodeHead<AnchorFree>(netOutputImg, letterbox, classIds, confidences, boxes);
+            break;
+        case AnchorFreeRows:
+            decodeHead<AnchorFreeRows>(netOutputImg, letterbox, classIds, confidences, boxes);
+            break;
         }
 
         //Perform non-maximum suppression to remove redundant overlapping boxes with lower confidence (NMS)
         std::vector<int> nms_result;
-        cv::dnn::NMSBoxes(boxes, confidences, nmsScoreThreshold, nms, nms_result);
+        cv::dnn::NMSBoxes(boxes, confidences, thresh, nms, nms_result);
         for (size_t i = 0; i < nms_result.size(); i++) {
             int idx = nms_result[i];
             objectInfoList[classIds[idx]].push_back(std::make_pair(boxes[idx],confidences[idx]));
@@ -113,6 +347,339 @@ bool Onnx::detect(cv::Mat &image, std::map<int, std::vector<std::pair<cv::Rect,
         return false;
     }
 }
+
+template <Onnx::HeadLayout layout>
+void Onnx::decodeHead(const std::vector<cv::Mat> &outputs, const Letterbox &letterbox, std::vector<int> &classIds, std::vector<float> &confidences, std::vector<cv::Rect> &boxes) const
+{
+    // Centre and size in network input pixels to a box in the frame, through the inverse letterbox.
+    const cv::Point2d inverse(1.0 / letterbox.scale.x, 1.0 / letterbox.scale.y);
+    const cv::Rect frame(cv::Point(0, 0), letterbox.frame);
+    auto addBox = [&](float x, float y, float w, float h, int classId, float score)
+    {
+        const cv::Point topLeft(cvRound((x - 0.5f * w - letterbox.content.x) * inverse.x), cvRound((y - 0.5f * h - letterbox.content.y) * inverse.y));
+        const cv::Point bottomRight(cvRound((x + 0.5f * w - letterbox.content.x) * inverse.x), cvRound((y + 0.5f * h - letterbox.content.y) * inverse.y));
+        const cv::Rect box = cv::Rect(topLeft, bottomRight) & frame;
+        if (box.empty())
+            return;
+        classIds.push_back(classId);
+        confidences.push_back(score);
+        boxes.push_back(box);
+    };
+
+    if constexpr (layout == AnchorGrid)
+    {
+        const int fields = classes_ + 5;
+        for (const GridOutput &head : gridOutputs_)
+        {
+            const float *pdata = outputs[head.output].ptr<float>();
+            const int anchors = static_cast<int>(head.anchors.size() / 2);
+            for (int anchor = 0; anchor < anchors; anchor++) {
+                const float anchor_w = head.anchors[anchor * 2];
+                const float anchor_h = head.anchors[anchor * 2 + 1];
+                for (int i = 0; i < head.grid.height; i++) {
+                    for (int j = 0; j < head.grid.width; j++, pdata += fields) {
+                        // The sigmoid is monotonic: compare logits and only squash what survives.
+                        if (pdata[4] < objectnessLogit_)
+                            continue;
+                        const float *best = std::max_element(pdata + 5, pdata + fields);
+                        const float score = sigmoid_x(pdata[4]) * sigmoid_x(*best);
+                        if (score < thresh)
+                            continue;
+                        const float x = (sigmoid_x(pdata[0]) * 2.f - 0.5f + j) * head.stride.x;
+                        const float y = (sigmoid_x(pdata[1]) * 2.f - 0.5f + i) * head.stride.y;
+                        const float w = powf(sigmoid_x(pdata[2]) * 2.f, 2.f) * anchor_w;
+                        const float h = powf(sigmoid_x(pdata[3]) * 2.f, 2.f) * anchor_h;
+                        addBox(x, y, w, h, static_cast<int>(best - (pdata + 5)), score);
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        // Decoded single-output heads. Channel-first heads store field k of box n at k * count + n.
+        constexpr bool channelsFirst = layout == AnchorFree;
+        constexpr int classOffset = layout == AnchorConcat ? 5 : 4;
+        const cv::Mat &output = outputs[0];
+        const int count = channelsFirst ? output.size[2] : output.size[1];
+        const size_t fieldStep = channelsFirst ? count : 1;
+        const size_t boxStep = channelsFirst ? 1 : classes_ + classOffset;
+        const float *pdata = output.ptr<float>();
+        for (int n = 0; n < count; n++, pdata += boxStep) {
+            float objectness = 1.f;
+            if constexpr (layout == AnchorConcat) {
+                objectness = pdata[4];
+                if (objectness < thresh)
+                    continue;
+            }
+            int classId = 0;
+            float best = pdata[classOffset * fieldStep];
+            for (int c = 1; c < classes_; c++) {
+                const float value = pdata[(classOffset + c) * fieldStep];
+                if (value > best) {
+                    best = value;
+                    classId = c;
+                }
+            }
+            const float score = objectness * best;
+            if (score < thresh)
+                continue;
+            addBox(pdata[0], pdata[fieldStep], pdata[2 * fieldStep], pdata[3 * fieldStep], classId, score);
+        }
+    }
+}
+
+bool Onnx::readInputSize(const std::string &modelFile, cv::Size &size, bool &dynamic, int &batch)
+{
+    std::ifstream file(modelFile, std::ios::binary);
+    const std::vector<uint8_t> model((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<int64_t> dims;
+    if (!graphInputDims(model, dims))
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = "Cannot read the input of " + modelFile;
+        return false;
+    }
+    if (dims.size() != 4 || (dims[1] > 0 && dims[1] != 3))
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = "Expected a [batch, 3, height, width] input in " + modelFile;
+        return false;
+    }
+    // Symbolic (dynamic) dimensions keep the configured size.
+    dynamic = dims[2] <= 0 && dims[3] <= 0;
+    batch = dims[0] > 0 ? static_cast<int>(dims[0]) : 0;
+    if (dims[2] > 0)
+        size.height = static_cast<int>(dims[2]);
+    if (dims[3] > 0)
+        size.width = static_cast<int>(dims[3]);
+    if (size.width <= 0 || size.height <= 0)
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = "Invalid network input size";
+        return false;
+    }
+    return true;
+}
+
+bool Onnx::inspectOutputs(const std::vector<float> &anchors)
+{
+    auto fail = [this](const std::string &message)
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = message;
+        return false;
+    };
+
+    // One forward pass on a blank input gives the output shapes; it also warms the backend up.
+    const int inputShape[] = {1, 3, inputSize_.height, inputSize_.width};
+    net_.setInput(cv::Mat(4, inputShape, CV_32F, cv::Scalar(0)));
+    outputNames_ = net_.getUnconnectedOutLayersNames();
+    std::vector<cv::Mat> outputs;
+    net_.forward(outputs, outputNames_);
+    if (outputs.empty())
+        return fail("The model has no outputs");
+    for (const cv::Mat &output : outputs)
+    {
+        if (output.depth() != CV_32F)
+            return fail("Only float model outputs are supported");
+    }
+
+    classes_ = static_cast<int>(names.size());
+    gridOutputs_.clear();
+    const cv::Mat &first = outputs[0];
+    if (first.dims == 5)
+    {
+        layout_ = AnchorGrid;
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            const cv::Mat &output = outputs[i];
+            if (output.dims != 5 || output.size[0] != 1 || output.size[4] != classes_ + 5)
+                return fail("Expected [1, anchors, gridY, gridX, " + std::to_string(classes_ + 5) + "] outputs for " + std::to_string(classes_) + " classes");
+            GridOutput head;
+            head.output = static_cast<int>(i);
+            head.grid = cv::Size(output.size[3], output.size[2]);
+            head.stride = cv::Point2f((float)inputSize_.width / head.grid.width, (float)inputSize_.height / head.grid.height);
+            head.anchors.resize(output.size[1] * 2);
+            gridOutputs_.push_back(head);
+        }
+        // Anchors are given smallest stride first, whatever order the outputs come in.
+        std::sort(gridOutputs_.begin(), gridOutputs_.end(), [](const GridOutput &a, const GridOutput &b) { return a.stride.x < b.stride.x; });
+
+        size_t anchorValues = 0;
+        for (const GridOutput &head : gridOutputs_)
+            anchorValues += head.anchors.size();
+        static const std::vector<float> yolov7Anchors = {12, 16, 19, 36, 40, 28, 36, 75, 76, 55, 72, 146, 142, 110, 192, 243, 459, 401};
+        const std::vector<float> &values = anchors.empty() ? yolov7Anchors : anchors;
+        if (values.size() != anchorValues)
+            return fail("The model needs " + std::to_string(anchorValues / 2) + " anchors, " + std::to_string(values.size() / 2) + " configured");
+        size_t position = 0;
+        for (GridOutput &head : gridOutputs_)
+        {
+            std::copy(values.begin() + position, values.begin() + position + head.anchors.size(), head.anchors.begin());
+            position += head.anchors.size();
+        }
+        return true;
+    }
+
+    if (outputs.size() != 1 || first.dims != 3 || first.size[0] != 1)
+        return fail("Unsupported detection head: expected per-stride [1, anchors, gridY, gridX, fields] outputs or one [1, rows, columns] output");
+    if (first.size[2] == classes_ + 5)
+        layout_ = AnchorConcat;
+    else if (first.size[1] == classes_ + 4)
+        layout_ = AnchorFree;
+    else if (first.size[2] == classes_ + 4)
+        layout_ = AnchorFreeRows;
+    else
+        return fail("The model output does not match " + std::to_string(classes_) + " classes");
+    return true;
+}
+
+bool Onnx::setPreprocessCache(PreprocessCache *cache)
+{
+    cache_ = cache != nullptr ? cache : &ownCache_;
+    return true;
+}
+
+void Onnx::prepareDegradedInput(const std::vector<float> &anchors)
+{
+    const cv::Size degraded(MAX(32, fullInputSize_.width / 2 / 32 * 32), MAX(32, fullInputSize_.height / 2 / 32 * 32));
+    if (degraded.width >= fullInputSize_.width && degraded.height >= fullInputSize_.height)
+    {
+        return;
+    }
+
+    // The head is inspected again at the smaller size; models that cannot run at it keep no degraded mode.
+    const ErrorDetails configured = errorDetails;
+    inputSize_ = degraded;
+    try
+    {
+        if (inspectOutputs(anchors))
+        {
+            degradedInputSize_ = degraded;
+            degradedGridOutputs_ = gridOutputs_;
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+    errorDetails = configured;
+    inputSize_ = fullInputSize_;
+    gridOutputs_ = fullGridOutputs_;
+}
+
+bool Onnx::setDegradedMode(bool degraded)
+{
+    if (degradedInputSize_.empty())
+    {
+        return false;
+    }
+    inputSize_ = degraded ? degradedInputSize_ : fullInputSize_;
+    gridOutputs_ = degraded ? degradedGridOutputs_ : fullGridOutputs_;
+    return true;
+}
+
+void Onnx::selectBackend()
+{
+    std::vector<cv::String> layerTypes;
+    net_.getLayerTypes(layerTypes);
+    precision_ = Float32;
+    for (const cv::String &type : layerTypes)
+    {
+        const std::string layerType = type;
+        if (layerType.size() > 4 && layerType.compare(layerType.size() - 4, 4, "Int8") == 0)
+        {
+            precision_ = Int8;
+            break;
+        }
+        if (layerType == "Quantize" || layerType == "Dequantize")
+        {
+            precision_ = FakeQuantized;
+        }
+    }
+
+    // The CUDA backend has no int8 layers, and requesting it without a CUDA build silently falls back anyway.
+    const std::vector<cv::dnn::Target> cudaTargets = cv::dnn::getAvailableTargets(cv::dnn::DNN_BACKEND_CUDA);
+    usesCuda_ = precision_ == Float32 && !cudaTargets.empty();
+    if (usesCuda_)
+    {
+        const bool fp16 = std::find(cudaTargets.begin(), cudaTargets.end(), cv::dnn::DNN_TARGET_CUDA_FP16) != cudaTargets.end();
+        net_.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA);
+        net_.setPreferableTarget(fp16 ? cv::dnn::DNN_TARGET_CUDA_FP16 : cv::dnn::DNN_TARGET_CUDA);
+    }
+    else
+    {
+        net_.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+        net_.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    }
+}
+
+bool Onnx::quantize(const std::string &directory, int maxImages, int batchSize)
+{
+    // The images go in as one batch, a fixed batch dimension takes exactly that many.
+    if (batchSize > 0)
+        maxImages = std::min(maxImages, batchSize);
+    std::vector<std::string> paths;
+    for (const auto &entry : fs::directory_iterator(directory))
+    {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (entry.is_regular_file() && (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp"))
+            paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    // Calibration sees exactly the blobs detect() will feed, so the activation ranges match.
+    std::vector<cv::Mat> blobs;
+    for (const std::string &path : paths)
+    {
+        if (static_cast<int>(blobs.size()) >= maxImages)
+            break;
+        cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+        if (image.empty())
+            continue;
+        ownCache_.newFrame();
+        ownCache_.letterbox(image, inputSize_, [&](const cv::Mat &blob, const Letterbox &) { blobs.push_back(blob.clone()); });
+    }
+    if (blobs.empty())
+    {
+        errorDetails.errorcode = FileNotFound;
+        errorDetails.errormsg = "No calibration images in " + directory;
+        return false;
+    }
+    if (batchSize > 0 && static_cast<int>(blobs.size()) != batchSize)
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = "Int8 calibration needs a dynamic batch dimension or " + std::to_string(batchSize) +
+                                " calibration images, the model has a fixed batch of " + std::to_string(batchSize);
+        return false;
+    }
+
+    // quantize() takes one blob per network input, so the images go in as one batch.
+    const int batchShape[] = {static_cast<int>(blobs.size()), 3, inputSize_.height, inputSize_.width};
+    cv::Mat batch(4, batchShape, CV_32F);
+    const size_t blobBytes = blobs[0].total() * blobs[0].elemSize();
+    for (size_t i = 0; i < blobs.size(); i++)
+    {
+        std::memcpy(batch.ptr<uchar>() + i * blobBytes, blobs[i].ptr<uchar>(), blobBytes);
+    }
+
+    // Per-channel weights, float input and outputs so preprocessing and decoding stay unchanged.
+    net_.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    net_.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    try
+    {
+        net_ = net_.quantize(std::vector<cv::Mat>{batch}, CV_32F, CV_32F, true);
+    }
+    catch (const cv::Exception &e)
+    {
+        errorDetails.errorcode = ConfigurationError;
+        errorDetails.errormsg = "Int8 calibration failed: " + std::string(e.what());
+        return false;
+    }
+    return true;
+}
+
 bool Onnx::fileExists(std::string& file)
 {
     fs::path filePath(file);
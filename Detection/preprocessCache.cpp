@@ -0,0 +1,116 @@
+#include "preprocessCache.H"
+
+PreprocessCache::PreprocessCache() : frame(1), computed(0), reused(0) {}
+
+void PreprocessCache::newFrame()
+{
+    frame++;
+}
+
+void PreprocessCache::rgb(const cv::Mat &image, const RgbConsumer &use)
+{
+    Entry &rgbEntry = entry(Rgb, cv::Size());
+    std::unique_lock<std::mutex> lock;
+    if (acquire(rgbEntry, image, lock))
+    {
+        cv::cvtColor(image, rgbEntry.input, cv::COLOR_BGR2RGB);
+        stamp(rgbEntry, image);
+    }
+    use(rgbEntry.input);
+}
+
+void PreprocessCache::letterbox(const cv::Mat &image, const cv::Size &inputSize, const BlobConsumer &use)
+{
+    Entry &blobEntry = entry(LetterboxBlob, inputSize);
+    std::unique_lock<std::mutex> lock;
+    if (!acquire(blobEntry, image, lock))
+    {
+        use(blobEntry.blob, blobEntry.letterbox);
+        return;
+    }
+
+    Letterbox &letterbox = blobEntry.letterbox;
+    letterbox.frame = image.size();
+    const double scale = std::min((double)inputSize.width / image.cols, (double)inputSize.height / image.rows);
+    const cv::Size scaled(std::min(inputSize.width, MAX(1, cvRound(image.cols * scale))),
+                          std::min(inputSize.height, MAX(1, cvRound(image.rows * scale))));
+    // Per axis, as resize() applies it after rounding the content size.
+    letterbox.scale = cv::Point2d((double)scaled.width / image.cols, (double)scaled.height / image.rows);
+    letterbox.content = cv::Rect(cv::Point((inputSize.width - scaled.width) / 2, (inputSize.height - scaled.height) / 2), scaled);
+
+    // The padding only needs repainting when the content area moves, i.e. when the frame geometry changes.
+    cv::Mat &input = blobEntry.input;
+    if (input.size() != inputSize || input.type() != CV_8UC3)
+    {
+        input.create(inputSize, CV_8UC3);
+        blobEntry.content = cv::Rect();
+    }
+    if (letterbox.content != blobEntry.content)
+    {
+        input.setTo(cv::Scalar(114, 114, 114));
+        blobEntry.content = letterbox.content;
+    }
+
+    cv::Mat content = input(letterbox.content);
+    if (scaled == image.size())
+        image.copyTo(content);
+    else
+        cv::resize(image, content, scaled, 0, 0, cv::INTER_LINEAR); // writes into the input image, content has the target size
+
+    // NCHW with the channels swapped to RGB: the split writes straight into the planes of the blob.
+    const int blobShape[] = {1, 3, inputSize.height, inputSize.width};
+    blobEntry.blob.create(4, blobShape, CV_32F);
+    input.convertTo(blobEntry.floatInput, CV_32F, 1 / 255.0);
+    float *planes = blobEntry.blob.ptr<float>();
+    const size_t planeSize = static_cast<size_t>(inputSize.area());
+    cv::Mat channels[] = {cv::Mat(inputSize, CV_32F, planes + 2 * planeSize),
+                          cv::Mat(inputSize, CV_32F, planes + planeSize),
+                          cv::Mat(inputSize, CV_32F, planes)};
+    cv::split(blobEntry.floatInput, channels);
+    stamp(blobEntry, image);
+
+    use(blobEntry.blob, letterbox);
+}
+
+PreprocessCache::Statistics PreprocessCache::statistics() const
+{
+    Statistics statistics;
+    statistics.computed = computed;
+    statistics.reused = reused;
+    return statistics;
+}
+
+PreprocessCache::Entry &PreprocessCache::entry(Kind kind, const cv::Size &size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<Entry> &existing : entries)
+    {
+        if (existing->kind == kind && existing->size == size)
+            return *existing;
+    }
+    entries.emplace_back(new Entry());
+    entries.back()->kind = kind;
+    entries.back()->size = size;
+    return *entries.back();
+}
+
+bool PreprocessCache::acquire(Entry &entry, const cv::Mat &image, std::unique_lock<std::mutex> &lock)
+{
+    lock = std::unique_lock<std::mutex>(entry.mutex);
+    const uint64_t current = frame;
+    // The frame number alone is not enough: a late detector may still ask for the previous image.
+    if (entry.frame == current && entry.source == image.data && entry.sourceSize == image.size())
+    {
+        reused++;
+        return false;
+    }
+    return true;
+}
+
+void PreprocessCache::stamp(Entry &entry, const cv::Mat &image)
+{
+    entry.frame = frame;
+    entry.source = image.data;
+    entry.sourceSize = image.size();
+    computed++;
+}
@@ -0,0 +1,336 @@
+#include "stageMetrics.H"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+    // Log-linear buckets: exact below subBucketCount, then subBucketHalf buckets per power of two.
+    const int subBucketBits = 6;
+    const uint64_t subBucketCount = 1ull << subBucketBits;
+    const uint64_t subBucketHalf = subBucketCount / 2;
+    const int maximumBits = 40; ///< Samples are clamped to 2^40 ns (about 18 minutes).
+    const size_t bucketCount = (maximumBits - subBucketBits + 2) * subBucketHalf + subBucketHalf;
+
+    size_t bucketIndex(uint64_t value)
+    {
+        value = std::min<uint64_t>(value, (1ull << maximumBits) - 1);
+        if (value < subBucketCount)
+            return static_cast<size_t>(value);
+        const int msb = 63 - __builtin_clzll(value);
+        const int shift = msb - subBucketBits + 1;
+        return static_cast<size_t>(shift * subBucketHalf + (value >> shift));
+    }
+
+    uint64_t bucketValue(size_t index)
+    {
+        if (index < subBucketCount)
+            return index;
+        const int shift = static_cast<int>(index / subBucketHalf) - 1;
+        const uint64_t sub = index - shift * subBucketHalf;
+        // Middle of the bucket.
+        return (sub << shift) + ((1ull << shift) >> 1);
+    }
+
+    struct Histogram
+    {
+        std::atomic<uint64_t> buckets[bucketCount];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> min;
+        std::atomic<uint64_t> max;
+
+        Histogram() : count(0), sum(0), min(std::numeric_limits<uint64_t>::max()), max(0)
+        {
+            for (auto &bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+
+        /** @brief Only called by the owning thread, so plain load/store pairs are enough. */
+        void record(uint64_t value)
+        {
+            auto &bucket = buckets[bucketIndex(value)];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            if (value < min.load(std::memory_order_relaxed))
+                min.store(value, std::memory_order_relaxed);
+            if (value > max.load(std::memory_order_relaxed))
+                max.store(value, std::memory_order_relaxed);
+        }
+
+        /** @brief Add the samples of other, called under the registry mutex. */
+        void merge(const Histogram &other)
+        {
+            for (size_t i = 0; i < bucketCount; i++)
+                buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            count.fetch_add(other.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            min.store(std::min(min.load(std::memory_order_relaxed), other.min.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            max.store(std::max(max.load(std::memory_order_relaxed), other.max.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        }
+
+        void clear()
+        {
+            for (auto &bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+            max.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    /** @brief Histograms of one thread, allocated per stage on first use. */
+    struct ThreadHistograms
+    {
+        std::atomic<Histogram *> stages[StageMetrics::StageCount];
+
+        ThreadHistograms()
+        {
+            for (auto &stage : stages)
+                stage.store(nullptr, std::memory_order_relaxed);
+        }
+        ~ThreadHistograms()
+        {
+            for (auto &stage : stages)
+                delete stage.load();
+        }
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadHistograms>> threads; ///< Threads still running.
+        std::shared_ptr<ThreadHistograms> retired = std::make_shared<ThreadHistograms>(); ///< Samples of exited threads.
+        std::atomic<bool> enabled{true};
+    };
+
+    Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    /**
+     * @brief Registers the histograms of its thread and, when the thread exits, folds them into
+     * Registry::retired so threads that come and go do not grow the registry.
+     */
+    struct ThreadRegistration
+    {
+        std::shared_ptr<ThreadHistograms> histograms;
+
+        ~ThreadRegistration()
+        {
+            if (!histograms)
+                return;
+            Registry &shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            for (int stage = 0; stage < StageMetrics::StageCount; stage++)
+            {
+                const Histogram *histogram = histograms->stages[stage].load(std::memory_order_acquire);
+                if (histogram == nullptr)
+                    continue;
+                Histogram *total = shared.retired->stages[stage].load(std::memory_order_acquire);
+                if (total == nullptr)
+                {
+                    total = new Histogram();
+                    shared.retired->stages[stage].store(total, std::memory_order_release);
+                }
+                total->merge(*histogram);
+            }
+            shared.threads.erase(std::remove(shared.threads.begin(), shared.threads.end(), histograms), shared.threads.end());
+        }
+    };
+
+    ThreadHistograms &threadHistograms()
+    {
+        // The registry is constructed first so it outlives the registration of the main thread.
+        Registry &shared = registry();
+        thread_local ThreadRegistration registration;
+        if (!registration.histograms)
+        {
+            registration.histograms = std::make_shared<ThreadHistograms>();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.threads.push_back(registration.histograms);
+        }
+        return *registration.histograms;
+    }
+}
+
+StageMetrics::ScopedTimer::ScopedTimer(Stage timedStage)
+    : stage(timedStage), start(std::chrono::steady_clock::now()), running(true)
+{
+}
+
+StageMetrics::ScopedTimer::~ScopedTimer()
+{
+    stop();
+}
+
+void StageMetrics::ScopedTimer::stop()
+{
+    if (running)
+    {
+        running = false;
+        record(stage, std::chrono::steady_clock::now() - start);
+    }
+}
+
+void StageMetrics::record(Stage stage, uint64_t nanoseconds)
+{
+    if (stage >= StageCount || !registry().enabled.load(std::memory_order_relaxed))
+        return;
+    ThreadHistograms &histograms = threadHistograms();
+    Histogram *histogram = histograms.stages[stage].load(std::memory_order_acquire);
+    if (histogram == nullptr)
+    {
+        histogram = new Histogram();
+        histograms.stages[stage].store(histogram, std::memory_order_release);
+    }
+    histogram->record(nanoseconds);
+}
+
+void StageMetrics::record(Stage stage, std::chrono::steady_clock::duration duration)
+{
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    record(stage, static_cast<uint64_t>(std::max<int64_t>(nanoseconds, 0)));
+}
+
+StageMetrics::Snapshot StageMetrics::snapshot()
+{
+    // Held throughout, so a thread exiting meanwhile is not counted both alive and retired.
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    std::vector<std::shared_ptr<ThreadHistograms>> threads = shared.threads;
+    threads.push_back(shared.retired);
+
+    Snapshot result;
+    std::vector<uint64_t> merged(bucketCount);
+    for (int stage = 0; stage < StageCount; stage++)
+    {
+        std::fill(merged.begin(), merged.end(), 0);
+        StageSnapshot stageSnapshot;
+        stageSnapshot.stage = static_cast<Stage>(stage);
+        stageSnapshot.name = stageName(stageSnapshot.stage);
+        uint64_t sum = 0;
+        uint64_t minimum = std::numeric_limits<uint64_t>::max();
+
+        for (const auto &thread : threads)
+        {
+            const Histogram *histogram = thread->stages[stage].load(std::memory_order_acquire);
+            if (histogram == nullptr)
+                continue;
+            for (size_t i = 0; i < bucketCount; i++)
+                merged[i] += histogram->buckets[i].load(std::memory_order_relaxed);
+            sum += histogram->sum.load(std::memory_order_relaxed);
+            minimum = std::min(minimum, histogram->min.load(std::memory_order_relaxed));
+            stageSnapshot.max = std::max(stageSnapshot.max, histogram->max.load(std::memory_order_relaxed));
+        }
+
+        // Count from the buckets so the percentiles are consistent with it.
+        for (uint64_t bucket : merged)
+            stageSnapshot.count += bucket;
+        if (stageSnapshot.count == 0)
+            continue;
+        stageSnapshot.min = minimum;
+        stageSnapshot.mean = static_cast<double>(sum) / stageSnapshot.count;
+
+        const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+        uint64_t *targets[4] = {&stageSnapshot.p50, &stageSnapshot.p90, &stageSnapshot.p99, &stageSnapshot.p999};
+        uint64_t seen = 0;
+        int next = 0;
+        for (size_t i = 0; i < bucketCount && next < 4; i++)
+        {
+            seen += merged[i];
+            while (next < 4 && seen >= static_cast<uint64_t>(quantiles[next] * stageSnapshot.count + 0.5) && seen > 0)
+            {
+                *targets[next] = std::min(std::max(bucketValue(i), stageSnapshot.min), stageSnapshot.max);
+                next++;
+            }
+        }
+        result.stages.push_back(stageSnapshot);
+    }
+    return result;
+}
+
+std::string StageMetrics::dump(const Snapshot &snapshot)
+{
+    std::ostringstream out;
+    out << std::left << std::setw(18) << "stage" << std::right
+        << std::setw(10) << "count" << std::setw(12) << "mean(us)" << std::setw(12) << "p50(us)"
+        << std::setw(12) << "p90(us)" << std::setw(12) << "p99(us)" << std::setw(12) << "p99.9(us)" << std::setw(12) << "max(us)" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (const StageSnapshot &stage : snapshot.stages)
+    {
+        out << std::left << std::setw(18) << stage.name << std::right
+            << std::setw(10) << stage.count
+            << std::setw(12) << stage.mean / 1000.0
+            << std::setw(12) << stage.p50 / 1000.0
+            << std::setw(12) << stage.p90 / 1000.0
+            << std::setw(12) << stage.p99 / 1000.0
+            << std::setw(12) << stage.p999 / 1000.0
+            << std::setw(12) << stage.max / 1000.0 << "\n";
+    }
+    return out.str();
+}
+
+void StageMetrics::reset()
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    std::vector<std::shared_ptr<ThreadHistograms>> threads = shared.threads;
+    threads.push_back(shared.retired);
+    for (const auto &thread : threads)
+    {
+        for (auto &stage : thread->stages)
+        {
+            Histogram *histogram = stage.load(std::memory_order_acquire);
+            if (histogram != nullptr)
+                histogram->clear();
+        }
+    }
+}
+
+void StageMetrics::setEnabled(bool enabled)
+{
+    registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool StageMetrics::isEnabled()
+{
+    return registry().enabled.load(std::memory_order_relaxed);
+}
+
+const char *StageMetrics::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case YoloPreprocess: return "yolo.preprocess";
+    case YoloForward: return "yolo.forward";
+    case YoloDecode: return "yolo.decode";
+    case OnnxPreprocess: return "onnx.preprocess";
+    case OnnxForward: return "onnx.forward";
+    case OnnxDecode: return "onnx.decode";
+    case ColorConvert: return "color.convert";
+    case ColorThreshold: return "color.threshold";
+    case ColorContours: return "color.contours";
+    case ObjectQueueWait: return "object.queue";
+    case ObjectDetection: return "object.detect";
+    case ColorQueueWait: return "color.queue";
+    case ColorDetection: return "color.detect";
+    case Detect: return "pipeline.detect";
+    case SaveSubmit: return "save.submit";
+    case SaveRedact: return "save.redact";
+    case SaveEncode: return "save.encode";
+    case SaveWrite: return "save.write";
+    case IngestRead: return "ingest.read";
+    case IngestDecode: return "ingest.decode";
+    case IngestWait: return "ingest.wait";
+    default: return "unknown";
+    }
+}
@@ -67,6 +67,12 @@ bool Yolo::configuration(DetectionConfigurationParameter parameters, PartitionDe
     }
     return true;
 }
+bool Yolo::setPreprocessCache(PreprocessCache *cache)
+{
+    cache_ = cache != nullptr ? cache : &ownCache_;
+    return true;
+}
+
 bool Yolo::detect(cv::Mat &matImage, std::map<int, std::vector<std::pair<cv::Rect, float>>> &objectInfoList, int &objectCount)
 {
     try
@@ -97,12 +103,18 @@ bool Yolo::detect(cv::Mat &matImage, std::map<int, std::vector<std::pair<cv::Rec
                     cv::Mat portion = matImage(roiRect);
 
                     // Perform detection on the 'portion' of the image
+                    StageMetrics::ScopedTimer preprocessTimer(StageMetrics::YoloPreprocess);
                     cvtColor(portion, inputRgb, cv::COLOR_BGR2RGB);
                     image portionDarknetImage = make_image(portion.cols, portion.rows, 3);
                     copy_image_from_bytes(portionDarknetImage, (char *)inputRgb.data);
+                    preprocessTimer.stop();
+
+                    StageMetrics::ScopedTimer forwardTimer(StageMetrics::YoloForward);
                     network_predict_image_letterbox(net, portionDarknetImage);
+                    forwardTimer.stop();
 
                     // Get detections for the 'portion' of the image
+                    StageMetrics::ScopedTimer decodeTimer(StageMetrics::YoloDecode);
                     nboxes = 0;
                     detections = get_network_boxes(net, portion.cols, portion.rows, thresh, threshHeir, nullptr, 1, &nboxes, 1);
 
@@ -130,11 +142,18 @@ bool Yolo::detect(cv::Mat &matImage, std::map<int, std::vector<std::pair<cv::Rec
             else
             {
                 // Perform detection on the entire 'matImage'
-                cvtColor(matImage, inputRgb, cv::COLOR_BGR2RGB);
+                StageMetrics::ScopedTimer preprocessTimer(StageMetrics::YoloPreprocess);
+                if (cache_ == &ownCache_)
+                    ownCache_.newFrame();
                 image darknetImage = make_image(matImage.cols, matImage.rows, 3);
-                copy_image_from_bytes(darknetImage, (char *)inputRgb.data);
+                cache_->rgb(matImage, [&](const cv::Mat &rgb) { copy_image_from_bytes(darknetImage, (char *)rgb.data); });
+                preprocessTimer.stop();
+
+                StageMetrics::ScopedTimer forwardTimer(StageMetrics::YoloForward);
                 network_predict_image_letterbox(net, darknetImage);
+                forwardTimer.stop();
 
+                StageMetrics::ScopedTimer decodeTimer(StageMetrics::YoloDecode);
                 nboxes = 0;
                 detections = get_network_boxes(net, matImage.cols, matImage.rows, thresh, threshHeir, nullptr, 1, &nboxes, 1);
 
@@ -0,0 +1,512 @@
+#include "frameArchive.H"
+#include "imagePersistence.H"
+
+#include <filesystem>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    const uint32_t segmentMagic = 0x5341564E; // "NVAS"
+    const uint32_t recordMagic = 0x5246564E;  // "NVFR"
+    const uint32_t formatVersion = 1;
+    const size_t flushThreshold = 8 << 20;    ///< Pending bytes that trigger a write.
+
+    struct SegmentHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t segment;
+        uint32_t reserved;
+    };
+
+    struct RecordHeader
+    {
+        uint32_t magic;
+        uint32_t recordSize;
+        int32_t sessionNumber;
+        int32_t codec;
+        int64_t timestamp;
+        uint32_t objectCount;
+        uint32_t colorCount;
+        uint32_t dataSize;
+        uint32_t reserved;
+    };
+
+    struct ObjectEntry
+    {
+        int32_t classId;
+        int32_t x, y, width, height;
+        float score;
+    };
+
+    struct ColorEntry
+    {
+        int32_t x, y, width, height;
+    };
+
+    size_t align8(size_t size)
+    {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    bool writeAllAt(int fd, const char *data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t count = ::pwrite(fd, data, size, offset);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += count;
+            size -= count;
+            offset += count;
+        }
+        return true;
+    }
+
+    bool readAllAt(int fd, char *data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t count = ::pread(fd, data, size, offset);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            data += count;
+            size -= count;
+            offset += count;
+        }
+        return true;
+    }
+
+    /** @brief Segment number of a "segment_<id>.nva" path, or -1. */
+    long segmentNumber(const std::filesystem::path &path)
+    {
+        const std::string name = path.filename().string();
+        unsigned long number = 0;
+        char suffix[8] = {0};
+        if (std::sscanf(name.c_str(), "segment_%lu.%3s", &number, suffix) == 2 && std::string(suffix) == "nva")
+            return static_cast<long>(number);
+        return -1;
+    }
+}
+
+std::string FrameArchive::segmentFileName(uint32_t segment)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment_%06u.nva", segment);
+    return name;
+}
+
+std::string FrameArchive::indexFileName(uint32_t segment)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment_%06u.idx", segment);
+    return name;
+}
+
+size_t FrameArchive::serializedSize(const Record &record)
+{
+    size_t objectCount = 0;
+    for (const auto &classObjects : record.objects)
+        objectCount += classObjects.second.size();
+    return align8(sizeof(RecordHeader) + objectCount * sizeof(ObjectEntry) +
+                  record.colorBoxes.size() * sizeof(ColorEntry) + record.data.size());
+}
+
+void FrameArchive::serialize(const Record &record, std::vector<char> &buffer)
+{
+    const size_t recordSize = serializedSize(record);
+    const size_t start = buffer.size();
+    buffer.resize(start + recordSize, 0);
+    char *out = buffer.data() + start;
+
+    RecordHeader header = {};
+    header.magic = recordMagic;
+    header.recordSize = static_cast<uint32_t>(recordSize);
+    header.sessionNumber = record.sessionNumber;
+    header.codec = record.codec;
+    header.timestamp = record.timestamp;
+    header.colorCount = static_cast<uint32_t>(record.colorBoxes.size());
+    header.dataSize = static_cast<uint32_t>(record.data.size());
+    for (const auto &classObjects : record.objects)
+        header.objectCount += static_cast<uint32_t>(classObjects.second.size());
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    for (const auto &classObjects : record.objects)
+    {
+        for (const auto &object : classObjects.second)
+        {
+            ObjectEntry entry = {classObjects.first, object.first.x, object.first.y, object.first.width, object.first.height, object.second};
+            std::memcpy(out, &entry, sizeof(entry));
+            out += sizeof(entry);
+        }
+    }
+    for (const cv::Rect &box : record.colorBoxes)
+    {
+        ColorEntry entry = {box.x, box.y, box.width, box.height};
+        std::memcpy(out, &entry, sizeof(entry));
+        out += sizeof(entry);
+    }
+    if (!record.data.empty())
+        std::memcpy(out, record.data.data(), record.data.size());
+}
+
+bool FrameArchive::deserialize(const char *data, size_t size, Record &record)
+{
+    RecordHeader header;
+    if (size < sizeof(header))
+        return false;
+    std::memcpy(&header, data, sizeof(header));
+    const size_t payload = sizeof(header) + static_cast<size_t>(header.objectCount) * sizeof(ObjectEntry) +
+                           static_cast<size_t>(header.colorCount) * sizeof(ColorEntry) + header.dataSize;
+    if (header.magic != recordMagic || header.recordSize > size || payload > header.recordSize)
+        return false;
+
+    const char *in = data + sizeof(header);
+    record.sessionNumber = header.sessionNumber;
+    record.codec = header.codec;
+    record.timestamp = header.timestamp;
+    record.objects.clear();
+    record.colorBoxes.clear();
+    for (uint32_t i = 0; i < header.objectCount; i++)
+    {
+        ObjectEntry entry;
+        std::memcpy(&entry, in, sizeof(entry));
+        in += sizeof(entry);
+        record.objects[entry.classId].push_back(std::make_pair(cv::Rect(entry.x, entry.y, entry.width, entry.height), entry.score));
+    }
+    record.colorBoxes.reserve(header.colorCount);
+    for (uint32_t i = 0; i < header.colorCount; i++)
+    {
+        ColorEntry entry;
+        std::memcpy(&entry, in, sizeof(entry));
+        in += sizeof(entry);
+        record.colorBoxes.push_back(cv::Rect(entry.x, entry.y, entry.width, entry.height));
+    }
+    record.data.assign(in, in + header.dataSize);
+    return true;
+}
+
+FrameArchiveWriter::FrameArchiveWriter() {}
+
+FrameArchiveWriter::~FrameArchiveWriter()
+{
+    close();
+}
+
+bool FrameArchiveWriter::open(const std::string &archiveDirectory, uint64_t size, std::string &error)
+{
+    close();
+    try
+    {
+        std::filesystem::create_directories(archiveDirectory);
+        directory = archiveDirectory;
+        segmentSize = std::max<uint64_t>(size, 1 << 20);
+
+        // Never touch existing segments, continue after the last one.
+        segment = 0;
+        for (const auto &file : std::filesystem::directory_iterator(directory))
+        {
+            long number = segmentNumber(file.path());
+            if (number >= 0 && static_cast<uint32_t>(number) >= segment)
+                segment = static_cast<uint32_t>(number) + 1;
+        }
+        pendingData.reserve(flushThreshold + (1 << 20));
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Unable to open frame archive: ") + e.what();
+        return false;
+    }
+}
+
+bool FrameArchiveWriter::append(const FrameArchive::Record &record)
+{
+    const uint64_t recordSize = FrameArchive::serializedSize(record);
+    if (segmentFd < 0 || segmentUsed + recordSize > segmentCapacity)
+    {
+        closeSegment();
+        if (!openSegment(recordSize))
+            return false;
+    }
+
+    FrameArchive::IndexEntry entry = {};
+    entry.sessionNumber = record.sessionNumber;
+    entry.segment = segment;
+    entry.offset = segmentUsed;
+    entry.length = static_cast<uint32_t>(recordSize);
+    entry.timestamp = record.timestamp;
+
+    FrameArchive::serialize(record, pendingData);
+    pendingIndex.push_back(entry);
+    segmentUsed += recordSize;
+
+    if (pendingData.size() >= flushThreshold)
+        return flush();
+    return true;
+}
+
+bool FrameArchiveWriter::flush(bool sync)
+{
+    if (segmentFd < 0)
+        return true;
+
+    bool ok = true;
+    if (!pendingData.empty())
+    {
+        ok = writeAllAt(segmentFd, pendingData.data(), pendingData.size(), segmentWritten);
+        if (ok)
+            segmentWritten += pendingData.size();
+        pendingData.clear();
+    }
+    // Index entries go out after their data so a crash never leaves dangling entries.
+    if (ok && !pendingIndex.empty())
+    {
+        const size_t bytes = pendingIndex.size() * sizeof(FrameArchive::IndexEntry);
+        const char *data = reinterpret_cast<const char *>(pendingIndex.data());
+        size_t done = 0;
+        while (done < bytes)
+        {
+            ssize_t count = ::write(indexFd, data + done, bytes - done);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+            {
+                ok = false;
+                break;
+            }
+            done += count;
+        }
+    }
+    pendingIndex.clear();
+
+    if (ok && sync)
+    {
+        ok = ::fdatasync(segmentFd) == 0 && ::fdatasync(indexFd) == 0;
+    }
+    if (!ok)
+    {
+        lastError = "Unable to write archive segment " + std::to_string(segment) + ": " + std::strerror(errno);
+    }
+    return ok;
+}
+
+bool FrameArchiveWriter::close()
+{
+    return closeSegment();
+}
+
+bool FrameArchiveWriter::openSegment(uint64_t minimumSize)
+{
+    segmentCapacity = std::max<uint64_t>(segmentSize, minimumSize + sizeof(SegmentHeader));
+    std::string segmentPath;
+    // The id may have been taken since open() scanned the directory: move on to the next free one.
+    do
+    {
+        segmentPath = (std::filesystem::path(directory) / FrameArchive::segmentFileName(segment)).string();
+        segmentFd = ::open(segmentPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (segmentFd < 0 && errno == EEXIST && ++segment != 0);
+    // A failed id is skipped too, the next append must not retry it for the rest of the session.
+    if (segmentFd < 0)
+    {
+        lastError = "Unable to create archive segment " + segmentPath + ": " + std::strerror(errno);
+        segment++;
+        return false;
+    }
+    const std::string indexPath = (std::filesystem::path(directory) / FrameArchive::indexFileName(segment)).string();
+    indexFd = ::open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (indexFd < 0)
+    {
+        lastError = "Unable to create archive index " + indexPath + ": " + std::strerror(errno);
+        ::close(segmentFd);
+        ::unlink(segmentPath.c_str());
+        segmentFd = -1;
+        segment++;
+        return false;
+    }
+
+    // Preallocating keeps the segment contiguous and avoids block allocation on every write.
+    ::posix_fallocate(segmentFd, 0, segmentCapacity);
+
+    SegmentHeader header = {segmentMagic, formatVersion, segment, 0};
+    const char *bytes = reinterpret_cast<const char *>(&header);
+    pendingData.insert(pendingData.end(), bytes, bytes + sizeof(header));
+    segmentUsed = sizeof(header);
+    segmentWritten = 0;
+    return true;
+}
+
+bool FrameArchiveWriter::closeSegment()
+{
+    if (segmentFd < 0)
+        return true;
+    bool ok = flush(true);
+    if (::ftruncate(segmentFd, segmentWritten) != 0)
+    {
+        lastError = "Unable to truncate archive segment " + std::to_string(segment) + ": " + std::strerror(errno);
+        ok = false;
+    }
+    ::close(segmentFd);
+    ::close(indexFd);
+    segmentFd = -1;
+    indexFd = -1;
+    segment++;
+    return ok;
+}
+
+FrameArchiveReader::FrameArchiveReader() {}
+
+FrameArchiveReader::~FrameArchiveReader()
+{
+    close();
+}
+
+bool FrameArchiveReader::open(const std::string &archiveDirectory, std::string &error)
+{
+    close();
+    try
+    {
+        directory = archiveDirectory;
+        std::vector<uint32_t> segments;
+        for (const auto &file : std::filesystem::directory_iterator(directory))
+        {
+            long number = segmentNumber(file.path());
+            if (number >= 0)
+                segments.push_back(static_cast<uint32_t>(number));
+        }
+        std::sort(segments.begin(), segments.end());
+
+        for (uint32_t number : segments)
+        {
+            const std::filesystem::path segmentPath = std::filesystem::path(directory) / FrameArchive::segmentFileName(number);
+            const std::filesystem::path indexPath = std::filesystem::path(directory) / FrameArchive::indexFileName(number);
+            int fd = ::open(segmentPath.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                error = "Unable to open archive segment: " + segmentPath.string();
+                close();
+                return false;
+            }
+            segmentFds[number] = fd;
+
+            // A torn trailing entry (writer did not shut down cleanly) is ignored.
+            const size_t indexBytes = std::filesystem::exists(indexPath) ? std::filesystem::file_size(indexPath) : 0;
+            std::vector<FrameArchive::IndexEntry> segmentEntries(indexBytes / sizeof(FrameArchive::IndexEntry));
+            if (!segmentEntries.empty())
+            {
+                int indexFd = ::open(indexPath.c_str(), O_RDONLY);
+                bool ok = indexFd >= 0 && readAllAt(indexFd, reinterpret_cast<char *>(segmentEntries.data()), segmentEntries.size() * sizeof(FrameArchive::IndexEntry), 0);
+                if (indexFd >= 0)
+                    ::close(indexFd);
+                if (!ok)
+                    segmentEntries.clear();
+            }
+            entries.insert(entries.end(), segmentEntries.begin(), segmentEntries.end());
+
+            // Records written after the last index append (crash between the data and the index
+            // write, or a missing index) are recovered from the segment.
+            const uint64_t indexedEnd = segmentEntries.empty() ? sizeof(SegmentHeader) : segmentEntries.back().offset + segmentEntries.back().length;
+            scanSegment(number, fd, indexedEnd);
+        }
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            sessionIndex[entries[i].sessionNumber].push_back(i);
+        }
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Unable to open frame archive: ") + e.what();
+        close();
+        return false;
+    }
+}
+
+void FrameArchiveReader::close()
+{
+    for (auto &segmentFd : segmentFds)
+    {
+        ::close(segmentFd.second);
+    }
+    segmentFds.clear();
+    entries.clear();
+    sessionIndex.clear();
+}
+
+bool FrameArchiveReader::read(size_t position, FrameArchive::Record &record)
+{
+    if (position >= entries.size())
+        return false;
+    const FrameArchive::IndexEntry &entry = entries[position];
+    auto segmentFd = segmentFds.find(entry.segment);
+    if (segmentFd == segmentFds.end())
+        return false;
+
+    readBuffer.resize(entry.length);
+    if (!readAllAt(segmentFd->second, readBuffer.data(), entry.length, entry.offset))
+        return false;
+    return FrameArchive::deserialize(readBuffer.data(), readBuffer.size(), record);
+}
+
+bool FrameArchiveReader::findSession(int sessionNumber, std::vector<FrameArchive::Record> &records)
+{
+    records.clear();
+    auto positions = sessionIndex.find(sessionNumber);
+    if (positions == sessionIndex.end())
+        return false;
+    for (size_t position : positions->second)
+    {
+        FrameArchive::Record record;
+        if (!read(position, record))
+            return false;
+        records.push_back(std::move(record));
+    }
+    return true;
+}
+
+bool FrameArchiveReader::decode(const FrameArchive::Record &record, cv::Mat &image, std::string &error)
+{
+    return ImagePersistenceService::decode(record.data, image, error);
+}
+
+bool FrameArchiveReader::scanSegment(uint32_t segment, int fd, uint64_t offset)
+{
+    const off_t fileSize = ::lseek(fd, 0, SEEK_END);
+    RecordHeader header;
+    while (offset + sizeof(header) <= static_cast<uint64_t>(fileSize))
+    {
+        // Preallocated but unused space reads back as zeros and ends the scan, as does a header
+        // whose counts do not add up to its size.
+        if (!readAllAt(fd, reinterpret_cast<char *>(&header), sizeof(header), offset) ||
+            header.magic != recordMagic || offset + header.recordSize > static_cast<uint64_t>(fileSize))
+            break;
+        const size_t payload = sizeof(header) + static_cast<size_t>(header.objectCount) * sizeof(ObjectEntry) +
+                               static_cast<size_t>(header.colorCount) * sizeof(ColorEntry) + header.dataSize;
+        if (header.recordSize != align8(payload))
+            break;
+
+        FrameArchive::IndexEntry entry = {};
+        entry.sessionNumber = header.sessionNumber;
+        entry.segment = segment;
+        entry.offset = offset;
+        entry.length = header.recordSize;
+        entry.timestamp = header.timestamp;
+        entries.push_back(entry);
+        offset += header.recordSize;
+    }
+    return true;
+}
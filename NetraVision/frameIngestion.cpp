@@ -0,0 +1,396 @@
+#include "frameIngestion.H"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    uint16_t bigEndian16(const uchar *data)
+    {
+        return static_cast<uint16_t>((data[0] << 8) | data[1]);
+    }
+
+    bool isImageFile(const std::filesystem::path &path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp" ||
+               extension == ".tif" || extension == ".tiff";
+    }
+}
+
+FrameIngestion::FrameIngestion() : isRunning(false), streamFinished(false) {}
+
+FrameIngestion::~FrameIngestion()
+{
+    close();
+}
+
+bool FrameIngestion::openDirectory(const std::string &directory, const Parameters &params, std::string &error)
+{
+    std::vector<std::string> paths;
+    try
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(directory))
+        {
+            if (entry.is_regular_file() && isImageFile(entry.path()))
+                paths.push_back(entry.path().string());
+        }
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Unable to list ") + directory + ": " + e.what();
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+    if (paths.empty())
+    {
+        error = "No images found in " + directory;
+        return false;
+    }
+    return openFiles(paths, params, error);
+}
+
+bool FrameIngestion::openFiles(const std::vector<std::string> &paths, const Parameters &params, std::string &error)
+{
+    close();
+    files = paths;
+    isStream = false;
+    return start(params, error);
+}
+
+bool FrameIngestion::openStream(const Parameters &params, std::string &error)
+{
+    close();
+    isStream = true;
+    return start(params, error);
+}
+
+bool FrameIngestion::start(const Parameters &params, std::string &error)
+{
+    if (params.decoderThreads < 1 || params.queueDepth < 1)
+    {
+        error = "Decoder threads and queue depth must be positive.";
+        return false;
+    }
+    try
+    {
+        parameters = params;
+        nextDecoder = 0;
+        nextPush = 0;
+        streamFinished = false;
+
+        // The slot rings only carry pointers into Decoder::slots, they must never delete them.
+        auto keepSlot = [](Slot *&) {};
+        const uint32_t capacity = parameters.queueDepth + 1;
+        for (int i = 0; i < parameters.decoderThreads; i++)
+        {
+            std::unique_ptr<Decoder> decoder(new Decoder());
+            decoder->jobs.reset(new SPSCBuffer<Job *>(capacity));
+            decoder->freeSlots.reset(new SPSCBuffer<Slot *>(capacity, keepSlot));
+            decoder->decodedSlots.reset(new SPSCBuffer<Slot *>(capacity, keepSlot));
+            for (int j = 0; j < parameters.queueDepth; j++)
+            {
+                decoder->slots.emplace_back(new Slot());
+                decoder->freeSlots->push(decoder->slots.back().get());
+            }
+            decoders.push_back(std::move(decoder));
+        }
+
+        isRunning = true;
+        for (size_t i = 0; i < decoders.size(); i++)
+        {
+            decoders[i]->thread.reset(new std::thread(&FrameIngestion::decodeLoop, this, i));
+        }
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Frame ingestion failed to start: ") + e.what();
+        close();
+        return false;
+    }
+}
+
+bool FrameIngestion::push(std::vector<uchar> &&data, const std::string &name)
+{
+    if (!isRunning || !isStream || streamFinished)
+    {
+        return false;
+    }
+
+    Decoder *decoder = decoders[nextPush % decoders.size()].get();
+    // Wait for room before pushing: a failed push counts as a drop in the buffer statistics,
+    // and with a single producer a push into a ring that is not full cannot fail.
+    if (decoder->jobs->isFull())
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        spaceCV.wait(lock, [&] { return !isRunning || !decoder->jobs->isFull(); });
+        lock.unlock();
+        if (!isRunning)
+        {
+            return false;
+        }
+    }
+    decoder->jobs->push(new Job{nextPush, name, std::move(data)});
+    nextPush++;
+    notify(decodeCV);
+    return true;
+}
+
+void FrameIngestion::finish()
+{
+    streamFinished = true;
+    notify(decodeCV);
+}
+
+bool FrameIngestion::next(Frame &frame)
+{
+    if (!isRunning)
+    {
+        return false;
+    }
+
+    Decoder *decoder = decoders[nextDecoder].get();
+    {
+        StageMetrics::ScopedTimer timer(StageMetrics::IngestWait);
+        std::unique_lock<std::mutex> lock(mutex);
+        readyCV.wait(lock, [&] { return !isRunning || !decoder->decodedSlots->isEmpty() || decoder->finished; });
+    }
+
+    Slot *slot = nullptr;
+    if (!decoder->decodedSlots->pop(slot))
+    {
+        // Frames are dealt round-robin: the first exhausted decoder ends the source.
+        return false;
+    }
+
+    frame.image = slot->image;
+    frame.index = slot->index;
+    frame.source = slot->source;
+    frame.scale = slot->scale;
+    frame.originalSize = slot->originalSize;
+    frame.error = slot->error;
+    frame.slot = slot;
+    frame.decoder = nextDecoder;
+    nextDecoder = (nextDecoder + 1) % decoders.size();
+    return true;
+}
+
+void FrameIngestion::release(Frame &frame)
+{
+    if (frame.slot == nullptr || frame.decoder >= decoders.size())
+    {
+        return;
+    }
+    frame.image.release();
+    decoders[frame.decoder]->freeSlots->push(frame.slot);
+    frame.slot = nullptr;
+    notify(decodeCV);
+}
+
+void FrameIngestion::close()
+{
+    isRunning = false;
+    notify(decodeCV);
+    notify(readyCV);
+    notify(spaceCV);
+
+    for (auto &decoder : decoders)
+    {
+        if (decoder->thread && decoder->thread->joinable())
+            decoder->thread->join();
+    }
+    decoders.clear();
+    files.clear();
+    isStream = false;
+}
+
+bool FrameIngestion::jpegSize(const uchar *data, size_t size, cv::Size &imageSize)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    {
+        return false;
+    }
+
+    size_t position = 2;
+    while (position + 4 <= size)
+    {
+        if (data[position] != 0xFF)
+            return false;
+        const uchar marker = data[position + 1];
+        if (marker == 0xFF)
+        {
+            position++; // fill byte
+            continue;
+        }
+        position += 2;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue; // markers without a segment
+        if (marker == 0xD9 || marker == 0xDA)
+            return false; // end of image or start of scan before any frame header
+
+        const size_t length = bigEndian16(data + position);
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC).
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            if (position + 7 > size)
+                return false;
+            imageSize = cv::Size(bigEndian16(data + position + 5), bigEndian16(data + position + 3));
+            return imageSize.width > 0 && imageSize.height > 0;
+        }
+        position += length;
+    }
+    return false;
+}
+
+int FrameIngestion::reductionFor(const cv::Size &imageSize, const cv::Size &target)
+{
+    if (target.empty() || imageSize.empty())
+    {
+        return 1;
+    }
+    for (int reduction : {8, 4, 2})
+    {
+        if (imageSize.width / reduction >= target.width && imageSize.height / reduction >= target.height)
+            return reduction;
+    }
+    return 1;
+}
+
+void FrameIngestion::decodeLoop(size_t decoderIndex)
+{
+    Decoder *decoder = decoders[decoderIndex].get();
+    size_t position = decoderIndex;
+
+    while (isRunning)
+    {
+        Job *job = nullptr;
+        if (isStream)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            decodeCV.wait(lock, [&] { return !isRunning || !decoder->jobs->isEmpty() || streamFinished; });
+            lock.unlock();
+            if (!decoder->jobs->pop(job))
+            {
+                if (!isRunning || streamFinished)
+                    break;
+                continue;
+            }
+            notify(spaceCV);
+        }
+        else if (position >= files.size())
+        {
+            break;
+        }
+
+        Slot *slot = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            decodeCV.wait(lock, [&] { return !isRunning || !decoder->freeSlots->isEmpty(); });
+        }
+        if (!decoder->freeSlots->pop(slot))
+        {
+            delete job;
+            break;
+        }
+
+        slot->error.clear();
+        if (job != nullptr)
+        {
+            slot->index = job->index;
+            slot->source = job->source;
+            decode(*slot, job->data.data(), job->data.size());
+            delete job;
+        }
+        else
+        {
+            slot->index = position;
+            slot->source = files[position];
+            position += decoders.size();
+            if (readFile(slot->source, slot->encoded))
+            {
+                decode(*slot, slot->encoded.data(), slot->encoded.size());
+            }
+            else
+            {
+                slot->image.release();
+                slot->error = "Unable to read " + slot->source;
+            }
+        }
+
+        decoder->decodedSlots->push(slot);
+        notify(readyCV);
+    }
+
+    decoder->finished = true;
+    notify(readyCV);
+}
+
+void FrameIngestion::decode(Slot &slot, const uchar *data, size_t size)
+{
+    StageMetrics::ScopedTimer timer(StageMetrics::IngestDecode);
+    slot.scale = 1;
+    slot.originalSize = cv::Size();
+    try
+    {
+        int flags = cv::IMREAD_COLOR;
+        if (jpegSize(data, size, slot.originalSize))
+        {
+            slot.scale = reductionFor(slot.originalSize, parameters.targetSize);
+            if (slot.scale == 8)
+                flags = cv::IMREAD_REDUCED_COLOR_8;
+            else if (slot.scale == 4)
+                flags = cv::IMREAD_REDUCED_COLOR_4;
+            else if (slot.scale == 2)
+                flags = cv::IMREAD_REDUCED_COLOR_2;
+        }
+
+        // Decoding into the pooled Mat reuses its buffer when the geometry is unchanged.
+        const cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, const_cast<uchar *>(data));
+        cv::imdecode(encoded, flags, &slot.image);
+        if (slot.image.empty())
+        {
+            slot.error = "Unable to decode " + slot.source;
+            return;
+        }
+        if (slot.originalSize.empty())
+        {
+            slot.originalSize = slot.image.size();
+        }
+    }
+    catch (std::exception &e)
+    {
+        slot.image.release();
+        slot.error = "Unable to decode " + slot.source + ": " + e.what();
+    }
+}
+
+bool FrameIngestion::readFile(const std::string &path, std::vector<uchar> &data)
+{
+    StageMetrics::ScopedTimer timer(StageMetrics::IngestRead);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return false;
+    }
+    const std::streamsize size = file.tellg();
+    if (size <= 0)
+    {
+        return false;
+    }
+    data.resize(static_cast<size_t>(size)); // keeps the capacity of earlier frames
+    file.seekg(0);
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(data.data()), size));
+}
+
+void FrameIngestion::notify(std::condition_variable &condition)
+{
+    // Taking the mutex orders the notification after the waiter's predicate check.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    condition.notify_all();
+}
@@ -0,0 +1,534 @@
+#include "imagePersistence.H"
+
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t directIOAlignment = 4096;
+    const int32_t rawMagic = 0x5752564E; // "NVRW"
+    const int maxRawSide = 1 << 16;      // Larger raw dimensions are taken for a corrupt header.
+    const int defaultJpegQuality = 95;
+    const int defaultPngCompression = 1; // Higher levels cost far more time than they save space on camera frames.
+
+    bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t count = ::write(fd, data, size);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+}
+
+ImagePersistenceService::ImagePersistenceService()
+    : isRunning(false), submitted(0), dropped(0), written(0), failed(0), encodeFailed(0), bytesWritten(0)
+{
+}
+
+ImagePersistenceService::~ImagePersistenceService()
+{
+    stop();
+}
+
+bool ImagePersistenceService::configuration(const Parameters &params, std::string &error)
+{
+    stop();
+    try
+    {
+        if (params.directory.empty())
+        {
+            error = "Image save directory is empty.";
+            return false;
+        }
+        if (params.encoderThreads < 1 || params.queueCapacity < 1 || params.batchSize < 1)
+        {
+            error = "Encoder threads, queue capacity and batch size must be positive.";
+            return false;
+        }
+        std::filesystem::create_directories(params.directory);
+        directoryFd = ::open(params.directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (directoryFd < 0)
+        {
+            error = "Unable to open image save directory: " + params.directory;
+            return false;
+        }
+
+        const int maxQuality = params.codec == Png ? 9 : 100;
+        if (params.codec != Raw && params.quality != -1 && (params.quality < 0 || params.quality > maxQuality))
+        {
+            error = "Image quality must be -1 or 0-" + std::to_string(maxQuality) + " for " + extension(params.codec) + ".";
+            return false;
+        }
+
+        if (params.storage == Archive && !archive.open(params.directory, params.segmentSize, error))
+        {
+            return false;
+        }
+
+        parameters = params;
+        if (parameters.quality == -1)
+            parameters.quality = parameters.codec == Png ? defaultPngCompression : defaultJpegQuality;
+        useDirectIO = params.directIO;
+        nextEncoder = 0;
+        submitted = dropped = written = failed = encodeFailed = bytesWritten = 0;
+        setError("");
+
+        // The rings only carry pointers into Encoder::slots, they must never delete them.
+        auto keepSlot = [](Slot *&) {};
+        for (int i = 0; i < parameters.encoderThreads; i++)
+        {
+            std::unique_ptr<Encoder> encoder(new Encoder());
+            const uint32_t capacity = parameters.queueCapacity + 1;
+            encoder->freeSlots.reset(new SPSCBuffer<Slot *>(capacity, keepSlot));
+            encoder->pendingSlots.reset(new SPSCBuffer<Slot *>(capacity, keepSlot));
+            encoder->encodedSlots.reset(new SPSCBuffer<Slot *>(capacity, keepSlot));
+            encoder->redaction.configuration(parameters.redaction);
+            for (int j = 0; j < parameters.queueCapacity; j++)
+            {
+                encoder->slots.emplace_back(new Slot());
+                encoder->freeSlots->push(encoder->slots.back().get());
+            }
+            encoders.push_back(std::move(encoder));
+        }
+
+        isRunning = true;
+        for (auto &encoder : encoders)
+        {
+            encoder->thread.reset(new std::thread(&ImagePersistenceService::encodeLoop, this, encoder.get()));
+        }
+        writerThread.reset(new std::thread(&ImagePersistenceService::writeLoop, this));
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Image service configuration failed: ") + e.what();
+        stop();
+        return false;
+    }
+}
+
+bool ImagePersistenceService::submit(const cv::Mat &image, int sessionNumber,
+                                     const std::map<int, std::vector<std::pair<cv::Rect, float>>> &objects,
+                                     const std::vector<cv::Rect> &colorBoxes)
+{
+    if (!isRunning || image.empty())
+    {
+        return false;
+    }
+
+    Encoder *encoder = encoders[nextEncoder].get();
+    Slot *slot = nullptr;
+    if (!encoder->freeSlots->pop(slot))
+    {
+        if (parameters.dropPolicy == DropNewest)
+        {
+            dropped++;
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        slotCV.wait(lock, [&] { return !isRunning || !encoder->freeSlots->isEmpty(); });
+        lock.unlock();
+        if (!encoder->freeSlots->pop(slot))
+        {
+            dropped++;
+            return false;
+        }
+    }
+
+    // copyTo() reuses the pooled buffer as long as the frame geometry does not change.
+    StageMetrics::ScopedTimer timer(StageMetrics::SaveSubmit);
+    image.copyTo(slot->image);
+    slot->record.sessionNumber = sessionNumber;
+    slot->record.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::system_clock::now().time_since_epoch()).count();
+    slot->record.codec = parameters.codec;
+    slot->record.objects = objects;
+    slot->record.colorBoxes = colorBoxes;
+    slot->encoded = false;
+    encoder->pendingSlots->push(slot);
+    submitted++;
+
+    // Only advance on success so the writer can collect the frames in the same order.
+    nextEncoder = (nextEncoder + 1) % encoders.size();
+    notify(encodeCV);
+    return true;
+}
+
+void ImagePersistenceService::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    flushCV.wait(lock, [this] { return !writerThread || written + failed >= submitted; });
+    if (!writerThread || parameters.storage != Archive)
+        return;
+    // Every record is appended, the writer still holds the last ones in the archive buffer.
+    archiveFlushRequested = true;
+    writeCV.notify_all();
+    flushCV.wait(lock, [this] { return !writerThread || !archiveFlushRequested; });
+}
+
+void ImagePersistenceService::stop()
+{
+    if (writerThread)
+    {
+        flush();
+    }
+
+    isRunning = false;
+    notify(encodeCV);
+    notify(writeCV);
+    notify(slotCV);
+
+    for (auto &encoder : encoders)
+    {
+        if (encoder->thread && encoder->thread->joinable())
+            encoder->thread->join();
+    }
+    if (writerThread && writerThread->joinable())
+    {
+        writerThread->join();
+    }
+    writerThread.reset();
+    encoders.clear();
+    if (!archive.close())
+    {
+        setError(archive.error());
+    }
+
+    if (directoryFd >= 0)
+    {
+        ::close(directoryFd);
+        directoryFd = -1;
+    }
+    std::free(alignedBuffer);
+    alignedBuffer = nullptr;
+    alignedBufferSize = 0;
+}
+
+ImagePersistenceService::Statistics ImagePersistenceService::statistics() const
+{
+    Statistics stats;
+    stats.submitted = submitted;
+    stats.dropped = dropped;
+    stats.written = written;
+    stats.failed = failed;
+    stats.encodeFailed = encodeFailed;
+    stats.bytesWritten = bytesWritten;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        stats.lastError = lastError;
+    }
+    stats.queued = stats.submitted - std::min(stats.submitted, stats.written + stats.failed);
+    return stats;
+}
+
+std::string ImagePersistenceService::extension(Codec codec)
+{
+    switch (codec)
+    {
+    case Png:
+        return ".png";
+    case Raw:
+        return ".raw";
+    case Jpeg:
+    default:
+        return ".jpg";
+    }
+}
+
+void ImagePersistenceService::encodeLoop(Encoder *encoder)
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        encodeCV.wait(lock, [&] { return !isRunning || !encoder->pendingSlots->isEmpty(); });
+        lock.unlock();
+
+        Slot *slot = nullptr;
+        if (!encoder->pendingSlots->pop(slot))
+        {
+            if (!isRunning)
+                break;
+            continue;
+        }
+        try
+        {
+            StageMetrics::ScopedTimer redactTimer(StageMetrics::SaveRedact);
+            encoder->redaction.apply(slot->image, slot->record.objects, slot->record.colorBoxes);
+            redactTimer.stop();
+
+            StageMetrics::ScopedTimer encodeTimer(StageMetrics::SaveEncode);
+            slot->encoded = encode(*slot);
+        }
+        catch (std::exception &e)
+        {
+            setError(std::string("Image redaction failed: ") + e.what());
+            slot->encoded = false;
+        }
+        if (!slot->encoded)
+            encodeFailed++;
+        encoder->encodedSlots->push(slot);
+        notify(writeCV);
+    }
+}
+
+void ImagePersistenceService::writeLoop()
+{
+    size_t current = 0;
+    std::vector<std::pair<Encoder *, Slot *>> batch;
+    batch.reserve(parameters.batchSize);
+    // Archive records are written in the archive's large chunks: on its threshold, every
+    // syncIntervalMs and on flush(), not after every batch.
+    const std::chrono::milliseconds syncInterval(std::max(parameters.syncIntervalMs, 1));
+    std::chrono::steady_clock::time_point lastArchiveFlush = std::chrono::steady_clock::now();
+    bool archivePending = false;
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto ready = [&] { return !isRunning || archiveFlushRequested || !encoders[current]->encodedSlots->isEmpty(); };
+        if (archivePending)
+            writeCV.wait_until(lock, lastArchiveFlush + syncInterval, ready);
+        else
+            writeCV.wait(lock, ready);
+        const bool flushRequested = archiveFlushRequested;
+        lock.unlock();
+
+        // Collect the frames that are ready, in submission order.
+        batch.clear();
+        Slot *slot = nullptr;
+        while (batch.size() < static_cast<size_t>(parameters.batchSize) && encoders[current]->encodedSlots->pop(slot))
+        {
+            batch.emplace_back(encoders[current].get(), slot);
+            current = (current + 1) % encoders.size();
+        }
+        for (auto &item : batch)
+        {
+            const FrameArchive::Record &record = item.second->record;
+            StageMetrics::ScopedTimer timer(StageMetrics::SaveWrite);
+            bool ok = item.second->encoded &&
+                      (parameters.storage == Archive ? archive.append(record) : writeFile(*item.second));
+            if (ok)
+            {
+                written++;
+                bytesWritten += record.data.size();
+            }
+            else
+            {
+                failed++;
+                // Encoding failures were reported by the encoder.
+                if (item.second->encoded)
+                    setError(parameters.storage == Archive ? archive.error() : "Unable to write " + fileName(record.sessionNumber));
+            }
+        }
+        if (parameters.storage == Archive)
+        {
+            archivePending = archivePending || !batch.empty();
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (archivePending && (flushRequested || now - lastArchiveFlush >= syncInterval))
+            {
+                if (!archive.flush(parameters.syncBatch))
+                    setError(archive.error());
+                archivePending = false;
+                lastArchiveFlush = now;
+            }
+            if (flushRequested)
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                archiveFlushRequested = false;
+            }
+        }
+        else if (parameters.syncBatch && directoryFd >= 0 && !batch.empty())
+        {
+            ::syncfs(directoryFd);
+        }
+
+        for (auto &item : batch)
+        {
+            item.first->freeSlots->push(item.second);
+        }
+        notify(slotCV);
+        notify(flushCV);
+        if (batch.empty() && !isRunning)
+            break;
+    }
+}
+
+bool ImagePersistenceService::encode(Slot &slot)
+{
+    try
+    {
+        if (parameters.codec == Raw)
+        {
+            const cv::Mat &image = slot.image;
+            const size_t rowBytes = image.cols * image.elemSize();
+            const int32_t header[4] = {rawMagic, image.rows, image.cols, image.type()};
+            std::vector<uchar> &data = slot.record.data;
+            data.resize(sizeof(header) + rowBytes * image.rows);
+            std::memcpy(data.data(), header, sizeof(header));
+            uchar *destination = data.data() + sizeof(header);
+            for (int row = 0; row < image.rows; row++)
+            {
+                std::memcpy(destination + row * rowBytes, image.ptr(row), rowBytes);
+            }
+            return true;
+        }
+
+        std::vector<int> encodeParameters;
+        if (parameters.codec == Png)
+        {
+            encodeParameters = {cv::IMWRITE_PNG_COMPRESSION, parameters.quality};
+        }
+        else
+        {
+            encodeParameters = {cv::IMWRITE_JPEG_QUALITY, parameters.quality};
+        }
+        if (cv::imencode(extension(parameters.codec), slot.image, slot.record.data, encodeParameters))
+        {
+            return true;
+        }
+        setError("Image encoding to " + extension(parameters.codec) + " failed.");
+        return false;
+    }
+    catch (std::exception &e)
+    {
+        setError(std::string("Image encoding failed: ") + e.what());
+        return false;
+    }
+}
+
+bool ImagePersistenceService::writeFile(const Slot &slot)
+{
+    const std::string path = (std::filesystem::path(parameters.directory) / fileName(slot.record.sessionNumber)).string();
+    const std::vector<uchar> &data = slot.record.data;
+    const size_t size = data.size();
+    int fd = -1;
+
+#ifdef O_DIRECT
+    if (useDirectIO)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (fd < 0 && errno == EINVAL)
+        {
+            // Filesystem without O_DIRECT support (tmpfs, some network mounts).
+            useDirectIO = false;
+        }
+    }
+    if (fd >= 0)
+    {
+        // O_DIRECT needs an aligned buffer and length, the padding is cut off again by ftruncate().
+        const size_t paddedSize = (size + directIOAlignment - 1) / directIOAlignment * directIOAlignment;
+        if (paddedSize > alignedBufferSize)
+        {
+            std::free(alignedBuffer);
+            alignedBuffer = nullptr;
+            alignedBufferSize = 0;
+            if (posix_memalign(&alignedBuffer, directIOAlignment, paddedSize) != 0)
+            {
+                alignedBuffer = nullptr;
+                ::close(fd);
+                return false;
+            }
+            alignedBufferSize = paddedSize;
+        }
+        std::memcpy(alignedBuffer, data.data(), size);
+        std::memset(static_cast<char *>(alignedBuffer) + size, 0, paddedSize - size);
+        bool ok = writeAll(fd, static_cast<const char *>(alignedBuffer), paddedSize) && ::ftruncate(fd, size) == 0;
+        ok = (::close(fd) == 0) && ok;
+        return ok;
+    }
+#endif
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = writeAll(fd, reinterpret_cast<const char *>(data.data()), size);
+    ok = (::close(fd) == 0) && ok;
+    return ok;
+}
+
+bool ImagePersistenceService::decode(const std::vector<uchar> &data, cv::Mat &image, std::string &error)
+{
+    try
+    {
+        int32_t header[4] = {0, 0, 0, 0};
+        if (data.size() >= sizeof(header))
+        {
+            std::memcpy(header, data.data(), sizeof(header));
+        }
+        if (header[0] != rawMagic)
+        {
+            image = cv::imdecode(data, cv::IMREAD_UNCHANGED, &image);
+            if (image.empty())
+            {
+                error = "Unable to decode the image.";
+                return false;
+            }
+            return true;
+        }
+
+        // The header comes from disk: check it before it sizes an allocation.
+        const int rows = header[1], cols = header[2], type = header[3];
+        if (rows <= 0 || cols <= 0 || rows > maxRawSide || cols > maxRawSide || type != CV_MAT_TYPE(type))
+        {
+            error = "Invalid raw image header.";
+            return false;
+        }
+        const size_t rowBytes = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+        const size_t payload = data.size() - sizeof(header);
+        if (rowBytes == 0 || payload / rowBytes < static_cast<size_t>(rows))
+        {
+            error = "Truncated raw image.";
+            return false;
+        }
+        image.create(rows, cols, type);
+        const uchar *source = data.data() + sizeof(header);
+        for (int row = 0; row < image.rows; row++)
+        {
+            std::memcpy(image.ptr(row), source + row * rowBytes, rowBytes);
+        }
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Image decoding failed: ") + e.what();
+        return false;
+    }
+}
+
+std::string ImagePersistenceService::fileName(int sessionNumber) const
+{
+    return parameters.filePrefix + std::to_string(sessionNumber) + extension(parameters.codec);
+}
+
+void ImagePersistenceService::setError(const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(errorMutex);
+    lastError = message;
+}
+
+void ImagePersistenceService::notify(std::condition_variable &condition)
+{
+    // Taking the mutex orders the notification after the waiter's predicate check.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    condition.notify_all();
+}
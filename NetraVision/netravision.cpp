@@ -0,0 +1,1155 @@
+#include "netravision.H"
+
+#include <future>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+    const uint32_t frameBufferSize = 4;  ///< Frames queued per detection thread.
+    const uint32_t resultBufferSize = 4; ///< Results queued per detection thread.
+
+    NetraVision::DetectionResult emptyDetection()
+    {
+        NetraVision::DetectionResult detection;
+        detection.objectCount = 0;
+        return detection;
+    }
+
+    NetraVision::ColorResult emptyColor()
+    {
+        NetraVision::ColorResult color;
+        color.colorCount = 0;
+        return color;
+    }
+}
+
+const std::string NetraVision::defaultModel = "default";
+
+NetraVision::NetraVision()
+    : colorDetector(nullptr),
+      colorConfigured(false),
+      isDRunning(true),
+      isCRunning(true),
+      colorRequest(0),
+      isSRunning(false),
+      processingEstimate{},
+      sessionNumber(0)
+{
+    imageColorBuffer.reset(new SPSCBuffer<QueuedFrame>(frameBufferSize));
+    colorResultBuffer.reset(new SPSCBuffer<ColorResult>(resultBufferSize));
+    imageSaver.reset(new ImagePersistenceService());
+
+    colorThread.reset(new std::thread(&NetraVision::colorDetectLoop, this));
+}
+
+NetraVision::~NetraVision()
+{
+    stopScheduler();
+    stopDetectionThreads();
+    imageSaver.reset();
+
+    for (auto &model : objectModels)
+    {
+        delete model->detector;
+        model->detector = nullptr;
+    }
+    delete colorDetector;
+    colorDetector = nullptr;
+}
+
+bool NetraVision::detectionConfiguration(DetectionObject method, DetectionLibrary::DetectionConfigurationParameter parameters, DetectionLibrary::PartitionDetectionConfigurationParameter partitionParameter, std::string &error)
+{
+    return detectionConfiguration(defaultModel, method, parameters, partitionParameter, error);
+}
+
+bool NetraVision::detectionConfiguration(const std::string &model, DetectionObject method, DetectionLibrary::DetectionConfigurationParameter parameters, DetectionLibrary::PartitionDetectionConfigurationParameter partitionParameter, std::string &error)
+{
+    try
+    {
+        DetectionLibrary *detector = nullptr;
+        switch (method)
+        {
+        case ObjectDetection:
+            detector = detectionSelector::generateDetection(detectionSelector::ObjectDetector);
+            break;
+        case Onnx:
+            detector = detectionSelector::generateDetection(detectionSelector::onnx);
+            break;
+        default:
+            break;
+        }
+        if (detector == nullptr)
+        {
+            error = "Invalid object detection method selected.";
+            return false;
+        }
+        if (!detector->configuration(parameters, partitionParameter))
+        {
+            error = "Object detection configuration of " + model + " failed.";
+            delete detector;
+            return false;
+        }
+        detector->setPreprocessCache(&preprocessCache);
+
+        ObjectModel *existing = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(modelsMutex);
+            for (auto &configured : objectModels)
+            {
+                if (configured->name == model)
+                    existing = configured.get();
+            }
+            if (existing == nullptr)
+            {
+                std::unique_ptr<ObjectModel> added(new ObjectModel());
+                added->name = model;
+                added->detector = detector;
+                added->frames.reset(new SPSCBuffer<QueuedFrame>(frameBufferSize));
+                added->results.reset(new SPSCBuffer<DetectionResult>(resultBufferSize));
+                objectModels.push_back(std::move(added));
+                objectModels.back()->thread.reset(new std::thread(&NetraVision::objectDetectLoop, this, objectModels.back().get()));
+                return true;
+            }
+        }
+
+        // Waits for the detection in progress, the new detector starts out of degraded mode.
+        std::lock_guard<std::mutex> detecting(existing->detectorMutex);
+        delete existing->detector;
+        existing->detector = detector;
+        existing->degraded = false;
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Object detection configuration encountered an exception: ") + e.what();
+        return false;
+    }
+}
+
+bool NetraVision::colorConfiguration(DetectionColor method, DetectionLibrary::ColorConfigurationParameters parameters, DetectionLibrary::PartitionDetectionConfigurationParameter partitionParameter, int height, int width, std::string &error)
+{
+    try
+    {
+        DetectionLibrary *detector = nullptr;
+        switch (method)
+        {
+        case ColorInRangeDetection:
+            detector = detectionSelector::generateDetection(detectionSelector::InRangeDetection);
+            break;
+        case RegionGrow:
+            detector = detectionSelector::generateDetection(detectionSelector::RegionGrow);
+            break;
+        default:
+            break;
+        }
+        if (detector == nullptr)
+        {
+            error = "Invalid color detection method selected.";
+            return false;
+        }
+        if (!detector->configuration(parameters, partitionParameter, height, width))
+        {
+            error = "Color configuration failed.";
+            delete detector;
+            return false;
+        }
+
+        // Waits for the color detection in progress.
+        std::lock_guard<std::mutex> detecting(colorDetectorMutex);
+        delete colorDetector;
+        colorDetector = detector;
+        colorConfigured = true;
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        error = std::string("Color configuration encountered an exception: ") + e.what();
+        return false;
+    }
+}
+
+std::vector<std::string> NetraVision::detectionModels() const
+{
+    std::vector<std::string> names;
+    for (const ObjectModel *model : models())
+    {
+        names.push_back(model->name);
+    }
+    return names;
+}
+
+std::vector<NetraVision::ObjectModel *> NetraVision::models() const
+{
+    std::lock_guard<std::mutex> lock(modelsMutex);
+    std::vector<ObjectModel *> configured;
+    configured.reserve(objectModels.size());
+    for (const auto &model : objectModels)
+    {
+        configured.push_back(model.get());
+    }
+    return configured;
+}
+
+void NetraVision::detectNetraVision(const cv::Mat &image, std::map<int, std::vector<std::pair<cv::Rect, float>>> &objectInfoList, int &objectCount, std::vector<cv::Rect> &colorDetectionResults, int &colorDetectionObjectCount, bool runDarknet, bool runColor, std::string &error)
+{
+    objectCount = 0;
+    colorDetectionObjectCount = 0;
+    ModelResults detections;
+    ColorResult color = emptyColor();
+    detectNetraVision(image, detections, color, runDarknet, runColor, error);
+
+    const std::vector<ObjectModel *> configured = models();
+    if (!configured.empty())
+    {
+        auto primary = detections.find(configured.front()->name);
+        if (primary != detections.end())
+        {
+            objectInfoList = std::move(primary->second.result);
+            objectCount = primary->second.objectCount;
+        }
+    }
+    if (runColor)
+    {
+        colorDetectionResults = std::move(color.results);
+        colorDetectionObjectCount = color.colorCount;
+    }
+}
+
+void NetraVision::detectNetraVision(const cv::Mat &image, ModelResults &detections, ColorResult &color, bool runDarknet, bool runColor, std::string &error)
+{
+    detectFrame(image, sessionNumber, 1, detections, color, runDarknet, runColor, error);
+}
+
+void NetraVision::detectFrame(const cv::Mat &image, int session, int scale, ModelResults &detections, ColorResult &color, bool runDarknet, bool runColor, std::string &error)
+{
+    try
+    {
+        StageMetrics::ScopedTimer timer(StageMetrics::Detect);
+        detections.clear();
+        color.colorCount = 0;
+        if (image.empty())
+        {
+            error = "Empty image passed for detection.";
+            return;
+        }
+
+        runFrame(image, detections, color.results, color.colorCount, runDarknet, runColor, false, scale, std::chrono::steady_clock::time_point::max(), error);
+
+        if (!parameters.saveImageFilePath.empty())
+        {
+            std::map<int, std::vector<std::pair<cv::Rect, float>>> saved;
+            savedDetections(detections, saved);
+            saveImageService(image, session, saved, color.results);
+        }
+    }
+    catch (std::exception &e)
+    {
+        error += std::string("Detection encountered an exception: ") + e.what();
+    }
+}
+
+const NetraVision::DetectionResult &NetraVision::primaryResult(const ModelResults &detections) const
+{
+    static const DetectionResult none = emptyDetection();
+    const std::vector<ObjectModel *> configured = models();
+    if (configured.empty())
+        return none;
+    auto primary = detections.find(configured.front()->name);
+    return primary != detections.end() ? primary->second : none;
+}
+
+int NetraVision::savedClassId(const std::string &model, int classId) const
+{
+    const std::vector<ObjectModel *> configured = models();
+    for (size_t index = 0; index < configured.size(); index++)
+    {
+        if (configured[index]->name == model)
+            return static_cast<int>(index) * savedClassStride + classId;
+    }
+    return -1;
+}
+
+void NetraVision::savedDetections(const ModelResults &detections, std::map<int, std::vector<std::pair<cv::Rect, float>>> &saved) const
+{
+    saved.clear();
+    const std::vector<ObjectModel *> configured = models();
+    for (size_t index = 0; index < configured.size(); index++)
+    {
+        auto found = detections.find(configured[index]->name);
+        if (found == detections.end())
+            continue;
+        for (const auto &objects : found->second.result)
+        {
+            auto &classObjects = saved[static_cast<int>(index) * savedClassStride + objects.first];
+            classObjects.insert(classObjects.end(), objects.second.begin(), objects.second.end());
+        }
+    }
+}
+
+bool NetraVision::runFrame(const cv::Mat &image, ModelResults &detections, std::vector<cv::Rect> &colorDetectionResults, int &colorDetectionObjectCount, bool runDarknet, bool runColor, bool degraded, int scale, std::chrono::steady_clock::time_point deadline, std::string &error)
+{
+    if (cascadeParameters.enabled && runDarknet)
+    {
+        return cascadeDetection(image, detections, colorDetectionResults, colorDetectionObjectCount, runColor, degraded, scale, deadline, error);
+    }
+
+    bool inTime = true;
+    bool detectorQueued = runDarknet && queueObjectDetection(image, degraded, error);
+    bool colorQueued = runColor && queueColorDetection(image, scale, error);
+    if (detectorQueued)
+        inTime = waitObjectDetection(detections, error, deadline);
+    if (colorQueued)
+        inTime = waitColorDetection(colorDetectionResults, colorDetectionObjectCount, error, deadline) && inTime;
+    return inTime;
+}
+
+bool NetraVision::cascadeConfiguration(RegionProposal::Parameters cascadeParameter, std::string &error)
+{
+    if (cascadeParameter.enabled && cascadeParameter.source == RegionProposal::Color && !colorConfigured)
+    {
+        error = "Color proposals need a configured color detector.";
+        return false;
+    }
+    cascadeParameters = cascadeParameter;
+    regionProposal.configuration(cascadeParameter);
+    return true;
+}
+
+bool NetraVision::imageServiceConfiguration(imageServiceParameter serviceParameters, std::string &error)
+{
+    parameters = serviceParameters;
+    if (parameters.saveImageFilePath.empty())
+    {
+        imageSaver->stop();
+        return true;
+    }
+
+    ImagePersistenceService::Parameters saveParameters;
+    saveParameters.directory = parameters.saveImageFilePath;
+    saveParameters.filePrefix = parameters.filePrefix;
+    saveParameters.codec = parameters.codec;
+    saveParameters.quality = parameters.quality;
+    saveParameters.encoderThreads = parameters.encoderThreads;
+    saveParameters.queueCapacity = parameters.queueCapacity;
+    saveParameters.dropPolicy = parameters.dropPolicy;
+    saveParameters.batchSize = parameters.batchSize;
+    saveParameters.directIO = parameters.directIO;
+    saveParameters.syncBatch = parameters.syncBatch;
+    saveParameters.storage = parameters.storage;
+    saveParameters.segmentSize = parameters.segmentSize;
+    saveParameters.syncIntervalMs = parameters.syncIntervalMs;
+    saveParameters.redaction = parameters.redaction;
+    if (!imageSaver->configuration(saveParameters, error))
+    {
+        parameters.saveImageFilePath.clear();
+        return false;
+    }
+    return true;
+}
+
+ImagePersistenceService::Statistics NetraVision::imageServiceStatistics() const
+{
+    return imageSaver->statistics();
+}
+
+NetraVision::PipelineStatistics NetraVision::pipelineStatistics() const
+{
+    PipelineStatistics statistics;
+    statistics.stages = StageMetrics::snapshot();
+    for (const ObjectModel *model : models())
+    {
+        statistics.queues.push_back(queueStatistics("imageDetectionBuffer[" + model->name + "]", *model->frames));
+        statistics.queues.push_back(queueStatistics("detectionResultBuffer[" + model->name + "]", *model->results));
+    }
+    statistics.queues.push_back(queueStatistics("imageColorBuffer", *imageColorBuffer));
+    statistics.queues.push_back(queueStatistics("colorResultBuffer", *colorResultBuffer));
+    if (pendingFrames)
+        statistics.queues.push_back(queueStatistics("pendingFrames", *pendingFrames));
+    statistics.save = imageSaver->statistics();
+    statistics.scheduler = schedulerStatistics();
+    statistics.preprocess = preprocessCache.statistics();
+    return statistics;
+}
+
+std::string NetraVision::pipelineStatisticsText() const
+{
+    const PipelineStatistics statistics = pipelineStatistics();
+    std::ostringstream out;
+    out << StageMetrics::dump(statistics.stages);
+    out << "\nqueue                             depth  capacity  highWater      pushed     dropped\n";
+    for (const QueueStatistics &queue : statistics.queues)
+    {
+        out << std::left << std::setw(32) << queue.name << std::right
+            << std::setw(7) << queue.depth << std::setw(10) << queue.capacity << std::setw(11) << queue.highWatermark
+            << std::setw(12) << queue.pushed << std::setw(12) << queue.dropped << "\n";
+    }
+    out << "\nsave: submitted " << statistics.save.submitted << ", queued " << statistics.save.queued
+        << ", written " << statistics.save.written << ", dropped " << statistics.save.dropped
+        << ", failed " << statistics.save.failed << " (encoding " << statistics.save.encodeFailed << ")"
+        << ", bytes " << statistics.save.bytesWritten << "\n";
+    if (!statistics.save.lastError.empty())
+        out << "save error: " << statistics.save.lastError << "\n";
+    out << "preprocess: computed " << statistics.preprocess.computed << ", reused " << statistics.preprocess.reused << "\n";
+    const SchedulerStatistics &scheduler = statistics.scheduler;
+    if (scheduler.submitted > 0 || scheduler.rejected > 0)
+    {
+        out << "scheduler: submitted " << scheduler.submitted << ", completed " << scheduler.completed
+            << ", degraded " << scheduler.degraded << ", rejected " << scheduler.rejected << ", dropped " << scheduler.dropped
+            << ", expired " << scheduler.expired << ", deadline missed " << scheduler.deadlineMissed
+            << ", late results " << scheduler.lateResults << ", color skipped " << scheduler.colorSkipped
+            << ", save skipped " << scheduler.saveSkipped << "\n";
+    }
+    return out.str();
+}
+
+bool NetraVision::replayArchive(const std::string &archiveDirectory, const ReplayCallback &callback, bool runDarknet, bool runColor, std::string &error)
+{
+    FrameArchiveReader reader;
+    if (!reader.open(archiveDirectory, error))
+    {
+        return false;
+    }
+
+    // The next record is read and decoded while the current one is detected.
+    struct ReplayFrame
+    {
+        FrameArchive::Record record;
+        cv::Mat image;
+        bool loaded = false;
+        std::string error;
+    };
+    ReplayFrame frames[2];
+    auto load = [&reader](size_t position, ReplayFrame &frame)
+    {
+        frame.error = "the record cannot be read.";
+        frame.loaded = reader.read(position, frame.record) && FrameArchiveReader::decode(frame.record, frame.image, frame.error);
+    };
+    std::future<void> next;
+    if (reader.size() > 0)
+        next = std::async(std::launch::async, load, 0, std::ref(frames[0]));
+
+    for (size_t position = 0; position < reader.size(); position++)
+    {
+        next.get();
+        ReplayFrame &frame = frames[position % 2];
+        if (!frame.loaded)
+        {
+            error = "Unable to read archive record " + std::to_string(position) + ": " + frame.error;
+            return false;
+        }
+        if (position + 1 < reader.size())
+            next = std::async(std::launch::async, load, position + 1, std::ref(frames[(position + 1) % 2]));
+
+        // Detection only: replayed frames are not saved again, the archive may be the one being read.
+        ModelResults detections;
+        ColorResult color = emptyColor();
+        std::string detectionError = "";
+        try
+        {
+            StageMetrics::ScopedTimer timer(StageMetrics::Detect);
+            runFrame(frame.image, detections, color.results, color.colorCount, runDarknet, runColor, false, 1, std::chrono::steady_clock::time_point::max(), detectionError);
+        }
+        catch (std::exception &e)
+        {
+            detectionError += std::string("Detection encountered an exception: ") + e.what();
+        }
+        DetectionResult detection = primaryResult(detections);
+        detection.error = detectionError;
+        if (callback)
+        {
+            callback(frame.record, frame.image, detection, color);
+        }
+    }
+    return true;
+}
+
+bool NetraVision::ingestNetraVision(FrameIngestion &ingestion, const IngestionCallback &callback, bool runDarknet, bool runColor, std::string &error)
+{
+    FrameIngestion::Frame frame;
+    size_t failedFrames = 0;
+    while (ingestion.next(frame))
+    {
+        DetectionResult detection;
+        ColorResult color;
+        detection.objectCount = 0;
+        color.colorCount = 0;
+        if (!frame.error.empty())
+        {
+            detection.error = frame.error;
+            failedFrames++;
+        }
+        else
+        {
+            // The frame index is the session number of saved frames, the caller's session number is left alone.
+            ModelResults detections;
+            std::string detectionError = "";
+            detectFrame(frame.image, static_cast<int>(frame.index), frame.scale, detections, color, runDarknet, runColor, detectionError);
+            detection = primaryResult(detections);
+            detection.error = detectionError;
+
+            // Frames decoded with DCT scaling are smaller than the source, report boxes in source coordinates.
+            if (frame.scale > 1)
+            {
+                const cv::Rect bounds(cv::Point(0, 0), frame.originalSize);
+                auto scaleBox = [&](cv::Rect &box)
+                {
+                    box = cv::Rect(box.x * frame.scale, box.y * frame.scale, box.width * frame.scale, box.height * frame.scale) & bounds;
+                };
+                for (auto &objects : detection.result)
+                {
+                    for (auto &object : objects.second)
+                        scaleBox(object.first);
+                }
+                for (auto &box : color.results)
+                {
+                    scaleBox(box);
+                }
+            }
+        }
+
+        if (callback)
+        {
+            callback(frame, detection, color);
+        }
+        ingestion.release(frame);
+    }
+
+    if (failedFrames > 0)
+    {
+        error = std::to_string(failedFrames) + " frames could not be read or decoded.";
+        return false;
+    }
+    return true;
+}
+
+bool NetraVision::schedulerConfiguration(schedulerParameter scheduling, const SchedulerCallback &callback, std::string &error)
+{
+    if (scheduling.enabled && (scheduling.budget.count() <= 0 || scheduling.queueCapacity < 1 || scheduling.degradeBelow < 0 || scheduling.degradeBelow > 1))
+    {
+        error = "Scheduler needs a positive budget and queue capacity and degradeBelow in [0, 1].";
+        return false;
+    }
+
+    stopScheduler();
+    schedulerParameters = scheduling;
+    schedulerCallback = callback;
+    if (!scheduling.enabled)
+    {
+        return true;
+    }
+
+    try
+    {
+        pendingFrames.reset(new SPSCBuffer<ScheduledFrame>(static_cast<uint32_t>(scheduling.queueCapacity) + 1));
+        processingEstimate[0] = processingEstimate[1] = std::chrono::nanoseconds(0);
+        isSRunning = true;
+        schedulerThread.reset(new std::thread(&NetraVision::schedulerLoop, this));
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        isSRunning = false;
+        error = std::string("Scheduler failed to start: ") + e.what();
+        return false;
+    }
+}
+
+bool NetraVision::submitNetraVision(const cv::Mat &image, uint64_t frameId, std::chrono::steady_clock::time_point trigger, bool runDarknet, bool runColor)
+{
+    if (!isSRunning || image.empty())
+    {
+        return false;
+    }
+
+    ScheduledFrame frame;
+    frame.image = image;
+    frame.frameId = frameId;
+    frame.trigger = trigger;
+    frame.deadline = trigger + schedulerParameters.budget;
+    frame.runDarknet = runDarknet;
+    frame.runColor = runColor;
+
+    bool queued = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Once a frame waits behind the full queue, later frames go behind it too so the order is kept.
+        if (!overflowFrames.empty() || !pendingFrames->push(frame))
+        {
+            if (schedulerParameters.policy == DropNewest)
+            {
+                queued = false;
+            }
+            else
+            {
+                // Only the newest frame behind the queue is kept, the one it replaces is reported as dropped.
+                for (ScheduledFrame &waiting : overflowFrames)
+                {
+                    waiting.image.release();
+                    waiting.outcome = Dropped;
+                }
+                overflowFrames.push_back(frame);
+            }
+        }
+    }
+    if (!queued)
+    {
+        schedulerCounters.rejected++;
+        return false;
+    }
+    schedulerCounters.submitted++;
+    schedulerCV.notify_one();
+    return true;
+}
+
+NetraVision::SchedulerStatistics NetraVision::schedulerStatistics() const
+{
+    SchedulerStatistics statistics;
+    statistics.submitted = schedulerCounters.submitted;
+    statistics.completed = schedulerCounters.completed;
+    statistics.degraded = schedulerCounters.degraded;
+    statistics.rejected = schedulerCounters.rejected;
+    statistics.dropped = schedulerCounters.dropped;
+    statistics.expired = schedulerCounters.expired;
+    statistics.deadlineMissed = schedulerCounters.deadlineMissed;
+    statistics.lateResults = schedulerCounters.lateResults;
+    statistics.colorSkipped = schedulerCounters.colorSkipped;
+    statistics.saveSkipped = schedulerCounters.saveSkipped;
+    return statistics;
+}
+
+void NetraVision::schedulerLoop()
+{
+    while (isSRunning)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            schedulerCV.wait(lock, [this] { return !isSRunning || !pendingFrames->isEmpty() || !overflowFrames.empty(); });
+        }
+
+        ScheduledFrame frame;
+        if (!nextScheduledFrame(frame))
+            continue;
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const std::chrono::nanoseconds remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.deadline - start);
+        if (remaining.count() <= 0)
+        {
+            reportScheduledFrame(frame, Expired, ModelResults(), emptyColor());
+            continue;
+        }
+
+        bool backlog = !pendingFrames->isEmpty();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            backlog = backlog || !overflowFrames.empty();
+        }
+        bool degraded = false;
+        if (schedulerParameters.policy == Degrade)
+        {
+            degraded = backlog || remaining < processingEstimate[0] || remaining < schedulerParameters.budget * schedulerParameters.degradeBelow;
+        }
+        // A frame that cannot make its deadline gives way to a waiting newer one; alone it still runs.
+        if (backlog && remaining < processingEstimate[degraded ? 1 : 0])
+        {
+            reportScheduledFrame(frame, Dropped, ModelResults(), emptyColor());
+            continue;
+        }
+
+        ModelResults detections;
+        ColorResult color = emptyColor();
+        std::string detectionError = "";
+        bool inTime = true;
+        try
+        {
+            StageMetrics::ScopedTimer timer(StageMetrics::Detect);
+            inTime = runFrame(frame.image, detections, color.results, color.colorCount, frame.runDarknet, frame.runColor && !degraded, degraded, 1, frame.deadline, detectionError);
+            if (frame.runColor && degraded)
+                schedulerCounters.colorSkipped++;
+
+            if (!parameters.saveImageFilePath.empty())
+            {
+                if (degraded)
+                    schedulerCounters.saveSkipped++;
+                else
+                {
+                    std::map<int, std::vector<std::pair<cv::Rect, float>>> saved;
+                    savedDetections(detections, saved);
+                    saveImageService(frame.image, static_cast<int>(frame.frameId), saved, color.results);
+                }
+            }
+        }
+        catch (std::exception &e)
+        {
+            detectionError += std::string("Scheduled detection encountered an exception: ") + e.what();
+        }
+        frame.error = detectionError;
+
+        const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        std::chrono::nanoseconds &estimate = processingEstimate[degraded ? 1 : 0];
+        const std::chrono::nanoseconds elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+        estimate = estimate.count() == 0 ? elapsed : (estimate * 7 + elapsed) / 8;
+
+        const FrameOutcome outcome = !inTime || end > frame.deadline ? DeadlineMissed : degraded ? Degraded : Completed;
+        reportScheduledFrame(frame, outcome, detections, color);
+    }
+
+    ScheduledFrame frame;
+    while (nextScheduledFrame(frame))
+    {
+        reportScheduledFrame(frame, Dropped, ModelResults(), emptyColor());
+    }
+}
+
+bool NetraVision::nextScheduledFrame(ScheduledFrame &frame)
+{
+    bool found = false;
+    while (true)
+    {
+        ScheduledFrame next;
+        bool taken = pendingFrames->pop(next);
+        std::vector<ScheduledFrame> displaced;
+        {
+            // Frames behind the full queue are newer than every queued one, they come last.
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto waiting = overflowFrames.begin(); waiting != overflowFrames.end();)
+            {
+                if (waiting->outcome == Dropped)
+                {
+                    displaced.push_back(std::move(*waiting));
+                    waiting = overflowFrames.erase(waiting);
+                }
+                else if (!taken)
+                {
+                    next = std::move(*waiting);
+                    waiting = overflowFrames.erase(waiting);
+                    taken = true;
+                }
+                else
+                {
+                    ++waiting;
+                }
+            }
+        }
+        for (ScheduledFrame &dropped : displaced)
+        {
+            reportScheduledFrame(dropped, Dropped, ModelResults(), emptyColor());
+        }
+
+        if (!taken)
+            return found;
+        if (found)
+            reportScheduledFrame(frame, Dropped, ModelResults(), emptyColor());
+        frame = std::move(next);
+        found = true;
+        if (schedulerParameters.policy != DropOldest)
+            return true;
+    }
+}
+
+void NetraVision::reportScheduledFrame(ScheduledFrame &frame, FrameOutcome outcome, const ModelResults &detections, const ColorResult &color)
+{
+    frame.outcome = outcome;
+    switch (outcome)
+    {
+    case Completed:
+        schedulerCounters.completed++;
+        break;
+    case Degraded:
+        schedulerCounters.degraded++;
+        break;
+    case Dropped:
+        schedulerCounters.dropped++;
+        break;
+    case Expired:
+        schedulerCounters.expired++;
+        break;
+    case DeadlineMissed:
+        schedulerCounters.deadlineMissed++;
+        break;
+    }
+    if (schedulerCallback)
+    {
+        schedulerCallback(frame, detections, color);
+    }
+}
+
+void NetraVision::stopScheduler()
+{
+    isSRunning = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    schedulerCV.notify_all();
+
+    if (schedulerThread && schedulerThread->joinable())
+        schedulerThread->join();
+    schedulerThread.reset();
+}
+
+void NetraVision::setSessionNumber(int number)
+{
+    sessionNumber = number;
+}
+
+bool NetraVision::trackingConfiguration(ObjectTracker::Parameters trackingParameter, std::string &error)
+{
+    if (trackingParameter.detectionInterval < 1)
+    {
+        error = "Detection interval must be at least 1.";
+        return false;
+    }
+    tracker.configuration(trackingParameter);
+    return true;
+}
+
+void NetraVision::trackNetraVision(const cv::Mat &image, std::vector<ObjectTracker::TrackedObject> &trackedObjects, int &objectCount, std::vector<cv::Rect> &colorDetectionResults, int &colorDetectionObjectCount, bool runColor, std::string &error)
+{
+    try
+    {
+        objectCount = 0;
+        colorDetectionObjectCount = 0;
+        trackedObjects.clear();
+        if (image.empty())
+        {
+            error = "Empty image passed for detection.";
+            return;
+        }
+
+        if (!tracker.configuration().enabled || tracker.needsDetection(image))
+        {
+            std::map<int, std::vector<std::pair<cv::Rect, float>>> objectInfoList;
+            int detectedCount = 0;
+            detectNetraVision(image, objectInfoList, detectedCount, colorDetectionResults, colorDetectionObjectCount, true, runColor, error);
+            tracker.update(objectInfoList, trackedObjects);
+        }
+        else
+        {
+            bool colorQueued = runColor && queueColorDetection(image, 1, error);
+            tracker.propagate(trackedObjects);
+            if (colorQueued)
+                waitColorDetection(colorDetectionResults, colorDetectionObjectCount, error);
+
+            if (!parameters.saveImageFilePath.empty())
+            {
+                std::map<int, std::vector<std::pair<cv::Rect, float>>> objectInfoList;
+                ObjectTracker::toDetections(trackedObjects, objectInfoList);
+                saveImageService(image, sessionNumber, objectInfoList, colorDetectionResults);
+            }
+        }
+        objectCount = static_cast<int>(trackedObjects.size());
+    }
+    catch (std::exception &e)
+    {
+        error += std::string("Tracking encountered an exception: ") + e.what();
+    }
+}
+
+bool NetraVision::cascadeDetection(const cv::Mat &image, ModelResults &detections, std::vector<cv::Rect> &colorDetectionResults, int &colorDetectionObjectCount, bool runColor, bool degraded, int scale, std::chrono::steady_clock::time_point deadline, std::string &error)
+{
+    const bool colorProposals = cascadeParameters.source == RegionProposal::Color;
+    std::vector<cv::Rect> colorBoxes;
+    int colorCount = 0;
+
+    // Color proposals are needed before the detector can start, motion ones are computed here
+    // while the color thread works.
+    bool colorQueued = (runColor || colorProposals) && queueColorDetection(image, scale, error);
+    if (colorProposals)
+    {
+        // No proposals to restrict the detection to: the whole frame is detected, error keeps the reason.
+        if (!colorQueued)
+            return !queueObjectDetection(image, degraded, error) || waitObjectDetection(detections, error, deadline);
+        if (!waitColorDetection(colorBoxes, colorCount, error, deadline))
+            return false;
+        colorQueued = false;
+    }
+
+    bool inTime = true;
+    std::vector<cv::Rect> regions;
+    regionProposal.propose(image, colorBoxes, regions);
+
+    if (!regions.empty())
+    {
+        if (regionProposal.pack(image, regions, proposalCanvas, proposalTiles))
+        {
+            ModelResults canvasDetections;
+            if (queueObjectDetection(proposalCanvas, degraded, error))
+            {
+                inTime = waitObjectDetection(canvasDetections, error, deadline);
+                // A detector that missed the deadline still reads the canvas, the next frame packs into a new one.
+                if (!inTime)
+                    proposalCanvas.release();
+                for (auto &canvas : canvasDetections)
+                {
+                    DetectionResult &detection = detections[canvas.first];
+                    detection.objectCount = RegionProposal::unpack(canvas.second.result, proposalTiles, detection.result);
+                    detection.error = canvas.second.error;
+                }
+            }
+        }
+        else if (queueObjectDetection(image, degraded, error))
+        {
+            inTime = waitObjectDetection(detections, error, deadline);
+        }
+    }
+    // No proposal: nothing but background, inference is skipped.
+
+    if (colorQueued)
+    {
+        inTime = waitColorDetection(colorBoxes, colorCount, error, deadline) && inTime;
+    }
+    if (runColor)
+    {
+        colorDetectionResults = std::move(colorBoxes);
+        colorDetectionObjectCount = colorCount;
+    }
+    return inTime;
+}
+
+bool NetraVision::queueObjectDetection(const cv::Mat &image, bool degraded, std::string &error)
+{
+    const std::vector<ObjectModel *> configured = models();
+    if (configured.empty())
+    {
+        error += "Object detector is not configured. ";
+        return false;
+    }
+
+    // The models preprocess the frame once between them.
+    preprocessCache.newFrame();
+    bool queued = false;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (ObjectModel *model : configured)
+    {
+        model->queued = model->frames->push(QueuedFrame{image, now, ++model->request, degraded});
+        if (!model->queued)
+        {
+            error += "Object detection buffer of " + model->name + " is full. ";
+            continue;
+        }
+        queued = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        model->frameCV.notify_one();
+    }
+    return queued;
+}
+
+bool NetraVision::queueColorDetection(const cv::Mat &image, int scale, std::string &error)
+{
+    if (!colorConfigured)
+    {
+        error += "Color detector is not configured. ";
+        return false;
+    }
+    if (!imageColorBuffer->push(QueuedFrame{image, std::chrono::steady_clock::now(), ++colorRequest, false, scale}))
+    {
+        error += "Color detection buffer is full. ";
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    colorCV.notify_one();
+    return true;
+}
+
+bool NetraVision::waitObjectDetection(ModelResults &detections, std::string &error, std::chrono::steady_clock::time_point deadline)
+{
+    // A model added after the frame was queued has nothing queued and is skipped.
+    bool inTime = true;
+    for (ObjectModel *model : models())
+    {
+        if (!model->queued)
+            continue;
+        model->queued = false;
+
+        DetectionResult result;
+        bool ready = true;
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto available = [model] { return !model->results->isEmpty(); };
+            if (deadline == std::chrono::steady_clock::time_point::max())
+            {
+                cv.wait(lock, available);
+            }
+            else if (!cv.wait_until(lock, deadline, available))
+            {
+                ready = false;
+                break;
+            }
+            lock.unlock();
+
+            model->results->pop(result);
+            if (result.request == model->request)
+                break;
+            schedulerCounters.lateResults++; // result of a frame given up earlier
+        }
+        if (!ready)
+        {
+            error += "Object detection of " + model->name + " missed the frame deadline. ";
+            inTime = false;
+            continue;
+        }
+        error += result.error;
+        detections[model->name] = std::move(result);
+    }
+    return inTime;
+}
+
+bool NetraVision::waitColorDetection(std::vector<cv::Rect> &colorDetectionResults, int &colorDetectionObjectCount, std::string &error, std::chrono::steady_clock::time_point deadline)
+{
+    ColorResult result;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto ready = [this] { return !colorResultBuffer->isEmpty(); };
+        if (deadline == std::chrono::steady_clock::time_point::max())
+        {
+            cv.wait(lock, ready);
+        }
+        else if (!cv.wait_until(lock, deadline, ready))
+        {
+            error += "Color detection missed the frame deadline. ";
+            return false;
+        }
+        lock.unlock();
+
+        colorResultBuffer->pop(result);
+        if (result.request == colorRequest)
+            break;
+        schedulerCounters.lateResults++; // result of a frame given up earlier
+    }
+    colorDetectionResults = std::move(result.results);
+    colorDetectionObjectCount = result.colorCount;
+    error += result.error;
+    return true;
+}
+
+bool NetraVision::colorDetection(cv::Mat &image, int scale, int &noOfObject, std::vector<cv::Rect> &boundingBox)
+{
+    // Contour size limits are in configured pixels, a reduced frame needs them scaled.
+    std::lock_guard<std::mutex> detecting(colorDetectorMutex);
+    if (colorDetector == nullptr || !colorDetector->setImageScale(scale))
+    {
+        return false;
+    }
+    return colorDetector->detect(image, noOfObject, boundingBox);
+}
+
+void NetraVision::objectDetectLoop(ObjectModel *model)
+{
+    while (isDRunning)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        model->frameCV.wait(lock, [&] { return !isDRunning || !model->frames->isEmpty(); });
+        lock.unlock();
+
+        QueuedFrame frame;
+        if (!model->frames->pop(frame))
+            continue;
+        StageMetrics::record(StageMetrics::ObjectQueueWait, std::chrono::steady_clock::now() - frame.queuedAt);
+        // Its waiter gave up at the deadline and queued a newer frame, nobody reads this result.
+        if (frame.request != model->request)
+            continue;
+
+        DetectionResult result;
+        result.objectCount = 0;
+        result.request = frame.request;
+        try
+        {
+            std::lock_guard<std::mutex> detecting(model->detectorMutex);
+            if (model->detector == nullptr)
+            {
+                result.error = "Object detection failed. ";
+            }
+            else
+            {
+                if (frame.degraded || model->degraded)
+                {
+                    model->detector->setDegradedMode(frame.degraded);
+                    model->degraded = frame.degraded;
+                }
+                StageMetrics::ScopedTimer timer(StageMetrics::ObjectDetection);
+                if (!model->detector->detect(frame.image, result.result, result.objectCount))
+                    result.error = "Object detection of " + model->name + " failed. ";
+            }
+        }
+        catch (std::exception &e)
+        {
+            result.error = std::string("Exception in objectDetectLoop: ") + e.what() + " ";
+        }
+
+        model->results->push(result);
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+        }
+        cv.notify_all();
+    }
+}
+
+void NetraVision::colorDetectLoop()
+{
+    while (isCRunning)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        colorCV.wait(lock, [this] { return !isCRunning || !imageColorBuffer->isEmpty(); });
+        lock.unlock();
+
+        QueuedFrame frame;
+        if (!imageColorBuffer->pop(frame))
+            continue;
+        StageMetrics::record(StageMetrics::ColorQueueWait, std::chrono::steady_clock::now() - frame.queuedAt);
+        if (frame.request != colorRequest)
+            continue;
+
+        ColorResult result;
+        result.colorCount = 0;
+        result.request = frame.request;
+        try
+        {
+            StageMetrics::ScopedTimer timer(StageMetrics::ColorDetection);
+            if (!colorDetection(frame.image, frame.scale, result.colorCount, result.results))
+                result.error = "Color detection failed. ";
+        }
+        catch (std::exception &e)
+        {
+            result.error = std::string("Exception in colorDetectLoop: ") + e.what() + " ";
+        }
+
+        colorResultBuffer->push(result);
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+        }
+        cv.notify_all();
+    }
+}
+
+void NetraVision::stopDetectionThreads()
+{
+    isDRunning = false;
+    isCRunning = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    for (auto &model : objectModels)
+    {
+        model->frameCV.notify_all();
+    }
+    colorCV.notify_all();
+
+    for (auto &model : objectModels)
+    {
+        if (model->thread && model->thread->joinable())
+            model->thread->join();
+    }
+    if (colorThread && colorThread->joinable())
+        colorThread->join();
+}
+
+void NetraVision::saveImageService(const cv::Mat &img, int imgNumber, const std::map<int, std::vector<std::pair<cv::Rect, float>>> &objectInfoList, const std::vector<cv::Rect> &colorResults)
+{
+    imageSaver->submit(img, imgNumber, objectInfoList, colorResults);
+}
@@ -0,0 +1,228 @@
+#include "objectTracker.H"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const int stateSize = 7;       ///< cx, cy, area, aspect, vx, vy, varea
+    const int measurementSize = 4; ///< cx, cy, area, aspect
+
+    cv::Mat toMeasurement(const cv::Rect &box)
+    {
+        cv::Mat measurement(measurementSize, 1, CV_32F);
+        measurement.at<float>(0) = box.x + box.width / 2.f;
+        measurement.at<float>(1) = box.y + box.height / 2.f;
+        measurement.at<float>(2) = static_cast<float>(box.width) * box.height;
+        measurement.at<float>(3) = static_cast<float>(box.width) / std::max(box.height, 1);
+        return measurement;
+    }
+
+    cv::Rect toBox(const cv::Mat &state)
+    {
+        const float area = std::max(state.at<float>(2), 1.f);
+        const float aspect = std::max(state.at<float>(3), 1e-3f);
+        const float width = std::sqrt(area * aspect);
+        const float height = area / width;
+        return cv::Rect(static_cast<int>(std::lround(state.at<float>(0) - width / 2)),
+                        static_cast<int>(std::lround(state.at<float>(1) - height / 2)),
+                        static_cast<int>(std::lround(width)), static_cast<int>(std::lround(height)));
+    }
+
+    float iou(const cv::Rect &a, const cv::Rect &b)
+    {
+        const float intersection = static_cast<float>((a & b).area());
+        const float united = static_cast<float>(a.area() + b.area()) - intersection;
+        return united > 0 ? intersection / united : 0.f;
+    }
+}
+
+ObjectTracker::ObjectTracker() {}
+
+void ObjectTracker::configuration(const Parameters &params)
+{
+    parameters = params;
+    reset();
+}
+
+void ObjectTracker::reset()
+{
+    tracks.clear();
+    keyFrame.release();
+    framesSinceDetection = 0;
+}
+
+bool ObjectTracker::needsDetection(const cv::Mat &image)
+{
+    const int scale = std::max(parameters.changeScale, 1);
+    cv::Mat small;
+    cv::resize(image, small, cv::Size(std::max(image.cols / scale, 1), std::max(image.rows / scale, 1)), 0, 0, cv::INTER_AREA);
+    if (small.channels() == 3)
+        cv::cvtColor(small, currentFrame, cv::COLOR_BGR2GRAY);
+    else
+        small.copyTo(currentFrame);
+
+    bool detect = keyFrame.empty() || keyFrame.size() != currentFrame.size() ||
+                  framesSinceDetection + 1 >= parameters.detectionInterval;
+    if (!detect)
+    {
+        cv::absdiff(currentFrame, keyFrame, difference);
+        detect = cv::mean(difference)[0] > parameters.changeThreshold;
+    }
+
+    if (detect)
+    {
+        std::swap(keyFrame, currentFrame);
+        framesSinceDetection = 0;
+    }
+    else
+    {
+        framesSinceDetection++;
+    }
+    return detect;
+}
+
+void ObjectTracker::update(const std::map<int, std::vector<std::pair<cv::Rect, float>>> &detections, std::vector<TrackedObject> &objects)
+{
+    predict();
+
+    // Candidate pairs of the same class, best overlap first.
+    struct Candidate
+    {
+        float overlap;
+        size_t track;
+        int classId;
+        size_t detection;
+    };
+    std::vector<Candidate> candidates;
+    for (size_t t = 0; t < tracks.size(); t++)
+    {
+        auto classDetections = detections.find(tracks[t].classId);
+        if (classDetections == detections.end())
+            continue;
+        for (size_t d = 0; d < classDetections->second.size(); d++)
+        {
+            const float overlap = iou(tracks[t].box, classDetections->second[d].first);
+            if (overlap >= parameters.iouThreshold)
+                candidates.push_back({overlap, t, classDetections->first, d});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.overlap > b.overlap; });
+
+    std::vector<bool> trackMatched(tracks.size(), false);
+    std::map<int, std::vector<bool>> detectionMatched;
+    for (const auto &classDetections : detections)
+        detectionMatched[classDetections.first].assign(classDetections.second.size(), false);
+
+    for (const Candidate &candidate : candidates)
+    {
+        if (trackMatched[candidate.track] || detectionMatched[candidate.classId][candidate.detection])
+            continue;
+        trackMatched[candidate.track] = true;
+        detectionMatched[candidate.classId][candidate.detection] = true;
+
+        Track &track = tracks[candidate.track];
+        const auto &detection = detections.at(candidate.classId)[candidate.detection];
+        track.filter.correct(toMeasurement(detection.first));
+        track.box = detection.first;
+        track.score = detection.second;
+        track.hits++;
+        track.missed = 0;
+        track.detected = true;
+    }
+
+    for (size_t t = 0; t < tracks.size(); t++)
+    {
+        if (!trackMatched[t])
+            tracks[t].missed++;
+    }
+    tracks.erase(std::remove_if(tracks.begin(), tracks.end(),
+                                [this](const Track &track) { return track.missed > parameters.maximumMissed; }),
+                 tracks.end());
+
+    for (const auto &classDetections : detections)
+    {
+        for (size_t d = 0; d < classDetections.second.size(); d++)
+        {
+            if (detectionMatched[classDetections.first][d])
+                continue;
+            Track track;
+            initTrack(track, classDetections.second[d].first);
+            track.trackId = nextTrackId++;
+            track.classId = classDetections.first;
+            track.score = classDetections.second[d].second;
+            tracks.push_back(std::move(track));
+        }
+    }
+
+    report(objects);
+}
+
+void ObjectTracker::propagate(std::vector<TrackedObject> &objects)
+{
+    predict();
+    report(objects);
+}
+
+void ObjectTracker::toDetections(const std::vector<TrackedObject> &objects, std::map<int, std::vector<std::pair<cv::Rect, float>>> &detections)
+{
+    for (const TrackedObject &object : objects)
+    {
+        detections[object.classId].push_back(std::make_pair(object.box, object.score));
+    }
+}
+
+void ObjectTracker::initTrack(Track &track, const cv::Rect &box)
+{
+    track.filter.init(stateSize, measurementSize, 0, CV_32F);
+    cv::setIdentity(track.filter.transitionMatrix);
+    track.filter.transitionMatrix.at<float>(0, 4) = 1.f;
+    track.filter.transitionMatrix.at<float>(1, 5) = 1.f;
+    track.filter.transitionMatrix.at<float>(2, 6) = 1.f;
+    cv::setIdentity(track.filter.measurementMatrix);
+
+    // Noise settings of the SORT reference implementation.
+    cv::setIdentity(track.filter.measurementNoiseCov);
+    track.filter.measurementNoiseCov.at<float>(2, 2) = 10.f;
+    track.filter.measurementNoiseCov.at<float>(3, 3) = 10.f;
+    cv::setIdentity(track.filter.errorCovPost, cv::Scalar(10.f));
+    for (int i = 4; i < stateSize; i++)
+        track.filter.errorCovPost.at<float>(i, i) = 10000.f;
+    cv::setIdentity(track.filter.processNoiseCov);
+    track.filter.processNoiseCov.at<float>(4, 4) = 0.01f;
+    track.filter.processNoiseCov.at<float>(5, 5) = 0.01f;
+    track.filter.processNoiseCov.at<float>(6, 6) = 0.0001f;
+
+    const cv::Mat measurement = toMeasurement(box);
+    track.filter.statePost.setTo(cv::Scalar::all(0));
+    for (int i = 0; i < measurementSize; i++)
+        track.filter.statePost.at<float>(i) = measurement.at<float>(i);
+
+    track.box = box;
+    track.hits = 1;
+    track.missed = 0;
+    track.detected = true;
+}
+
+void ObjectTracker::predict()
+{
+    for (Track &track : tracks)
+    {
+        // Keep the predicted area positive.
+        if (track.filter.statePost.at<float>(2) + track.filter.statePost.at<float>(6) <= 0)
+            track.filter.statePost.at<float>(6) = 0;
+        track.box = toBox(track.filter.predict());
+        track.detected = false;
+    }
+}
+
+void ObjectTracker::report(std::vector<TrackedObject> &objects) const
+{
+    objects.clear();
+    for (const Track &track : tracks)
+    {
+        if (track.hits < parameters.minimumHits)
+            continue;
+        objects.push_back({track.trackId, track.classId, track.box, track.score, track.detected});
+    }
+}
@@ -0,0 +1,200 @@
+#include "redactionFilter.H"
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+    /**
+     * @brief Box blur of one row span from the integral image rows bounding its kernel.
+     * Written as a flat loop over interleaved channels so the compiler can vectorize it.
+     */
+    template <typename T>
+    void blurSpan(const T *top, const T *bottom, uchar *destination, int begin, int end, int left, int right, float inverseArea)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            const T sum = bottom[k + right] - top[k + right] - bottom[k - left] + top[k - left];
+            destination[k] = static_cast<uchar>(static_cast<float>(sum) * inverseArea + 0.5f);
+        }
+    }
+
+    template <typename T>
+    void blurRows(const cv::Mat &integral, cv::Mat &image, const cv::Rect &bounds, const std::vector<cv::Rect> &boxes, int radius)
+    {
+        const int channels = image.channels();
+        const int left = radius * channels;
+        const int right = (radius + 1) * channels;
+        const float inverseArea = 1.f / static_cast<float>((2 * radius + 1) * (2 * radius + 1));
+
+        int firstRow = INT_MAX, lastRow = INT_MIN;
+        for (const cv::Rect &box : boxes)
+        {
+            firstRow = std::min(firstRow, box.y);
+            lastRow = std::max(lastRow, box.y + box.height);
+        }
+
+        for (int y = firstRow; y < lastRow; y++)
+        {
+            const int localY = y - bounds.y;
+            const T *top = integral.ptr<T>(localY - radius);
+            const T *bottom = integral.ptr<T>(localY + radius + 1);
+            uchar *row = image.ptr<uchar>(y);
+
+            for (const cv::Rect &box : boxes)
+            {
+                if (y < box.y || y >= box.y + box.height)
+                    continue;
+                const int begin = (box.x - bounds.x) * channels;
+                const int end = (box.x + box.width - bounds.x) * channels;
+                // Shift so that destination[k] is the pixel matching integral column k.
+                uchar *destination = row + bounds.x * channels;
+                blurSpan<T>(top, bottom, destination, begin, end, left, right, inverseArea);
+            }
+        }
+    }
+}
+
+RedactionFilter::RedactionFilter() {}
+
+RedactionFilter::RedactionFilter(const Parameters &params)
+    : parameters(params)
+{
+}
+
+void RedactionFilter::configuration(const Parameters &params)
+{
+    parameters = params;
+}
+
+void RedactionFilter::apply(cv::Mat &image, const std::map<int, std::vector<std::pair<cv::Rect, float>>> &objects, const std::vector<cv::Rect> &colorBoxes)
+{
+    if (parameters.mode == None)
+        return;
+
+    std::vector<cv::Rect> selected;
+    for (const auto &classObjects : objects)
+    {
+        if (!parameters.classes.empty() &&
+            std::find(parameters.classes.begin(), parameters.classes.end(), classObjects.first) == parameters.classes.end())
+            continue;
+        for (const auto &object : classObjects.second)
+            selected.push_back(object.first);
+    }
+    if (parameters.includeColorBoxes)
+    {
+        selected.insert(selected.end(), colorBoxes.begin(), colorBoxes.end());
+    }
+    apply(image, selected);
+}
+
+void RedactionFilter::apply(cv::Mat &image, const std::vector<cv::Rect> &inputBoxes)
+{
+    if (parameters.mode == None || image.empty() || inputBoxes.empty())
+        return;
+
+    const cv::Rect imageRect(0, 0, image.cols, image.rows);
+    const int padding = std::max(parameters.padding, 0);
+    boxes.clear();
+    for (const cv::Rect &box : inputBoxes)
+    {
+        cv::Rect padded = cv::Rect(box.x - padding, box.y - padding, box.width + 2 * padding, box.height + 2 * padding) & imageRect;
+        if (!padded.empty())
+            boxes.push_back(padded);
+    }
+    if (boxes.empty())
+        return;
+
+    if (parameters.mode == Mask)
+    {
+        maskBoxes(image, boxes);
+        return;
+    }
+
+    const int radius = std::max(parameters.blurRadius, 1);
+    if (image.depth() != CV_8U)
+    {
+        for (const cv::Rect &box : boxes)
+        {
+            cv::Mat roi = image(box);
+            cv::blur(roi, roi, cv::Size(2 * radius + 1, 2 * radius + 1));
+        }
+        return;
+    }
+
+    // Group boxes whose kernel neighbourhoods overlap so each group shares one integral image.
+    std::vector<cv::Rect> groupBounds;
+    std::vector<std::vector<cv::Rect>> groups;
+    for (const cv::Rect &box : boxes)
+    {
+        groupBounds.push_back(cv::Rect(box.x - radius, box.y - radius, box.width + 2 * radius, box.height + 2 * radius));
+        groups.push_back(std::vector<cv::Rect>(1, box));
+    }
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < groups.size() && !merged; i++)
+        {
+            for (size_t j = i + 1; j < groups.size(); j++)
+            {
+                if ((groupBounds[i] & groupBounds[j]).empty())
+                    continue;
+                groupBounds[i] |= groupBounds[j];
+                groups[i].insert(groups[i].end(), groups[j].begin(), groups[j].end());
+                groupBounds.erase(groupBounds.begin() + j);
+                groups.erase(groups.begin() + j);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        blurGroup(image, groupBounds[i], groups[i]);
+    }
+}
+
+void RedactionFilter::blurGroup(cv::Mat &image, const cv::Rect &bounds, const std::vector<cv::Rect> &groupBoxes)
+{
+    const int radius = std::max(parameters.blurRadius, 1);
+    const cv::Rect imageRect(0, 0, image.cols, image.rows);
+    const cv::Rect inside = bounds & imageRect;
+
+    // The integral must be taken before any box is written, the writes go to image in place.
+    cv::Mat source;
+    if (inside == bounds)
+    {
+        source = image(bounds);
+    }
+    else
+    {
+        cv::copyMakeBorder(image(inside), border,
+                           inside.y - bounds.y, bounds.y + bounds.height - inside.y - inside.height,
+                           inside.x - bounds.x, bounds.x + bounds.width - inside.x - inside.width,
+                           cv::BORDER_REPLICATE);
+        source = border;
+    }
+
+    // 32-bit sums are exact as long as the whole group cannot exceed INT_MAX.
+    const double maximumSum = 255.0 * bounds.width * bounds.height * image.channels();
+    if (maximumSum < static_cast<double>(INT_MAX))
+    {
+        cv::integral(source, integral, CV_32S);
+        blurRows<int>(integral, image, bounds, groupBoxes, radius);
+    }
+    else
+    {
+        cv::integral(source, integral, CV_64F);
+        blurRows<double>(integral, image, bounds, groupBoxes, radius);
+    }
+}
+
+void RedactionFilter::maskBoxes(cv::Mat &image, const std::vector<cv::Rect> &groupBoxes)
+{
+    for (const cv::Rect &box : groupBoxes)
+    {
+        image(box).setTo(parameters.maskColor);
+    }
+}
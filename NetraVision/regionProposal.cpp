@@ -0,0 +1,171 @@
+#include "regionProposal.H"
+
+#include <algorithm>
+#include <cmath>
+
+RegionProposal::RegionProposal() {}
+
+void RegionProposal::configuration(const Parameters &params)
+{
+    parameters = params;
+    reset();
+}
+
+void RegionProposal::reset()
+{
+    previousGray.release();
+}
+
+void RegionProposal::propose(const cv::Mat &image, const std::vector<cv::Rect> &colorBoxes, std::vector<cv::Rect> &regions)
+{
+    regions.clear();
+    std::vector<cv::Rect> boxes;
+    if (parameters.source == Motion)
+        motionBoxes(image, boxes);
+    else
+        boxes = colorBoxes;
+
+    const cv::Rect imageRect(0, 0, image.cols, image.rows);
+    const int padding = std::max(parameters.padding, 0);
+    for (const cv::Rect &box : boxes)
+    {
+        if (box.area() < parameters.minimumArea)
+            continue;
+        cv::Rect padded = cv::Rect(box.x - padding, box.y - padding, box.width + 2 * padding, box.height + 2 * padding) & imageRect;
+        if (!padded.empty())
+            regions.push_back(padded);
+    }
+
+    // Merge overlapping proposals so an object is never split between two crops.
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; i++)
+        {
+            for (size_t j = i + 1; j < regions.size(); j++)
+            {
+                if ((regions[i] & regions[j]).empty())
+                    continue;
+                regions[i] |= regions[j];
+                regions.erase(regions.begin() + j);
+                merged = true;
+                break;
+            }
+        }
+    }
+}
+
+bool RegionProposal::pack(const cv::Mat &image, const std::vector<cv::Rect> &regions, cv::Mat &canvas, std::vector<Tile> &tiles)
+{
+    tiles.clear();
+    if (regions.empty())
+        return false;
+
+    const int gap = std::max(parameters.tileGap, 0);
+    double area = 0;
+    int widest = 0;
+    for (const cv::Rect &region : regions)
+    {
+        area += static_cast<double>(region.width + gap) * (region.height + gap);
+        widest = std::max(widest, region.width);
+    }
+    if (area >= parameters.maximumCanvasRatio * image.cols * image.rows)
+        return false;
+
+    // Shelf packing, tallest crops first, on a roughly square canvas.
+    std::vector<size_t> order(regions.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return regions[a].height > regions[b].height; });
+
+    const int canvasWidth = std::max(widest, static_cast<int>(std::ceil(std::sqrt(area))));
+    int x = 0, y = 0, shelfHeight = 0;
+    tiles.resize(regions.size());
+    for (size_t index : order)
+    {
+        const cv::Rect &region = regions[index];
+        if (x > 0 && x + region.width > canvasWidth)
+        {
+            x = 0;
+            y += shelfHeight + gap;
+            shelfHeight = 0;
+        }
+        tiles[index].source = region;
+        tiles[index].canvas = cv::Rect(x, y, region.width, region.height);
+        x += region.width + gap;
+        shelfHeight = std::max(shelfHeight, region.height);
+    }
+    const int canvasHeight = y + shelfHeight;
+    if (static_cast<double>(canvasWidth) * canvasHeight >= parameters.maximumCanvasRatio * image.cols * image.rows)
+    {
+        tiles.clear();
+        return false;
+    }
+
+    canvas.create(canvasHeight, canvasWidth, image.type());
+    canvas.setTo(cv::Scalar::all(0));
+    for (const Tile &tile : tiles)
+    {
+        image(tile.source).copyTo(canvas(tile.canvas));
+    }
+    return true;
+}
+
+int RegionProposal::unpack(const std::map<int, std::vector<std::pair<cv::Rect, float>>> &canvasObjects, const std::vector<Tile> &tiles,
+                           std::map<int, std::vector<std::pair<cv::Rect, float>>> &objects)
+{
+    int count = 0;
+    for (const auto &classObjects : canvasObjects)
+    {
+        for (const auto &object : classObjects.second)
+        {
+            const cv::Rect &box = object.first;
+            const cv::Point centre(box.x + box.width / 2, box.y + box.height / 2);
+            for (const Tile &tile : tiles)
+            {
+                if (!tile.canvas.contains(centre))
+                    continue;
+                cv::Rect clipped = box & tile.canvas;
+                clipped.x += tile.source.x - tile.canvas.x;
+                clipped.y += tile.source.y - tile.canvas.y;
+                objects[classObjects.first].push_back(std::make_pair(clipped, object.second));
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+void RegionProposal::motionBoxes(const cv::Mat &image, std::vector<cv::Rect> &boxes)
+{
+    const int scale = std::max(parameters.motionScale, 1);
+    cv::Mat small;
+    cv::resize(image, small, cv::Size(std::max(image.cols / scale, 1), std::max(image.rows / scale, 1)), 0, 0, cv::INTER_AREA);
+    if (small.channels() == 3)
+        cv::cvtColor(small, currentGray, cv::COLOR_BGR2GRAY);
+    else
+        small.copyTo(currentGray);
+
+    if (previousGray.empty() || previousGray.size() != currentGray.size())
+    {
+        // Nothing to compare against yet: propose the whole frame.
+        boxes.push_back(cv::Rect(0, 0, image.cols, image.rows));
+        std::swap(previousGray, currentGray);
+        return;
+    }
+
+    cv::absdiff(currentGray, previousGray, difference);
+    cv::threshold(difference, difference, parameters.motionThreshold, 255, cv::THRESH_BINARY);
+    cv::dilate(difference, difference, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(difference, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    for (const auto &contour : contours)
+    {
+        cv::Rect box = cv::boundingRect(contour);
+        boxes.push_back(cv::Rect(box.x * scale, box.y * scale, box.width * scale, box.height * scale));
+    }
+    std::swap(previousGray, currentGray);
+}
@@ -1,7 +1,7 @@
 /** *********************************************************************************
  * @file spscbuffer.h
  * @author Dharmil Shah (dharmil.shah@ishitva.in)
- * @version 0.1
+ * @version 0.3
  * @date 2023-07-13
  * 
  * @brief SPSCBuffer is a wait-free single-producer/single-consumer queue 
@@ -27,13 +27,16 @@
  * Version history
  * ---------------
  * 
- * \b [v0.1] Initial version
+ * \b [v0.1] Initial version \n
+ * \b [v0.2] Push/drop counters and high watermark for pipeline statistics \n
+ * \b [v0.3] Pop counter and depth() readable from any thread
  ***********************************************************************************/
 
 #ifndef SPSCBUFFER_H
 #define SPSCBUFFER_H
 
 #include <iostream>
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdlib>
@@ -189,11 +192,20 @@ class SPSCBuffer
         auto nextWrite = (currentWrite + 1) % capacity_;
         
         if (nextWrite == readIndex_.load(std::memory_order_acquire)){
-            return false; // buffer is full
+            // buffer is full
+            droppedCount_.store(droppedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
         }
 
         new (&buffer_[currentWrite]) T(data);
         writeIndex_.store(nextWrite, std::memory_order_release);
+
+        // Only the producer writes these counters, so no read-modify-write is needed.
+        pushedCount_.store(pushedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        size_t size = sizeGuess();
+        if (size > highWatermark_.load(std::memory_order_relaxed)){
+            highWatermark_.store(size, std::memory_order_relaxed);
+        }
         return true;
     }
 
@@ -254,6 +266,7 @@ class SPSCBuffer
 
         auto nextRead = (currentRead + 1) % capacity_;
         readIndex_.store(nextRead, std::memory_order_release);
+        poppedCount_.store(poppedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return true;
     }
 
@@ -297,6 +310,7 @@ class SPSCBuffer
         buffer_[currentRead].~T();
         auto nextRead = (currentRead + 1) % capacity_;
         readIndex_.store(nextRead, std::memory_order_release);
+        poppedCount_.store(poppedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return true;
     }
 
@@ -339,6 +353,7 @@ class SPSCBuffer
             callbackFunction(buffer_[currentRead]);
         auto nextRead = (currentRead + 1) % capacity_;
         readIndex_.store(nextRead, std::memory_order_release);
+        poppedCount_.store(poppedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return true;
     }
 
@@ -388,6 +403,29 @@ class SPSCBuffer
     /** @brief maximum number of items in the queue. */
     size_t capacity() const noexcept { return capacity_-1; }
 
+    /** @brief number of successful push() calls. Can be read from any thread. */
+    uint64_t pushedCount() const noexcept { return pushedCount_.load(std::memory_order_relaxed); }
+
+    /** @brief number of successful pops. Can be read from any thread. */
+    uint64_t poppedCount() const noexcept { return poppedCount_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Approximate number of elements, pushes minus pops. Can be read from any thread,
+     * unlike sizeGuess(): the counters are relaxed, so the value may lag behind by a few elements.
+     */
+    size_t depth() const noexcept
+    {
+        const uint64_t popped = poppedCount();
+        const uint64_t pushed = pushedCount();
+        return pushed > popped ? std::min<uint64_t>(pushed - popped, capacity()) : 0;
+    }
+
+    /** @brief number of push() calls rejected because the buffer was full. Can be read from any thread. */
+    uint64_t droppedCount() const noexcept { return droppedCount_.load(std::memory_order_relaxed); }
+
+    /** @brief largest number of elements seen in the buffer right after a push. Can be read from any thread. */
+    size_t highWatermark() const noexcept { return highWatermark_.load(std::memory_order_relaxed); }
+
 /**********/
   private:
 /**********/
@@ -415,6 +453,14 @@ class SPSCBuffer
      * wants to do with that element inside callback function.
      */
     const std::function< void(T&) > callbackFunctionToCallWhilePop;
+
+    /** @brief statistics, written by the producer only. */
+    std::atomic<uint64_t> pushedCount_{0};
+    std::atomic<uint64_t> droppedCount_{0};
+    std::atomic<size_t> highWatermark_{0};
+
+    /** @brief statistics, written by the consumer only. */
+    std::atomic<uint64_t> poppedCount_{0};
 };
 
 
@@ -0,0 +1,599 @@
+#include "syntheticData.H"
+#include "json.H"
+#include "netravision.H"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Benchmark of the detectors and the NetraVision pipeline.
+ *
+ * Every case runs in a forked child, so the peak RSS is that of the case alone and a crash
+ * only fails its own case. Results are written as one JSON document.
+ */
+namespace
+{
+    struct Options
+    {
+        std::string imageDirectory;                 ///< Empty: synthetic frames.
+        std::string outputFile;                     ///< Empty: stdout.
+        std::string workDirectory = "benchmark-models";
+        std::vector<std::string> suites = {"yolo", "onnx", "color", "pipeline"};
+        std::vector<cv::Size> resolutions = {cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080)};
+        std::vector<int> partitions = {0, 2, 4};
+        std::vector<int> colorRanges = {1, 2, 4};
+        std::vector<int> threads = {1, 2, 4};
+        std::string pipelineDetector = "yolo";
+        int frames = 30;
+        int warmup = 3;
+        int classes = 3;
+        int darknetInputSize = 416;
+        unsigned seed = 1;
+        bool fork = true;
+    };
+
+    struct Case
+    {
+        std::string suite;
+        cv::Size resolution;
+        int partitions;
+        int colorRanges;
+        int threads;
+    };
+
+    struct Models
+    {
+        DetectionLibrary::DetectionConfigurationParameter yolo;
+        DetectionLibrary::DetectionConfigurationParameter onnx;
+    };
+
+    /** @brief Detects one frame, returns false with error set on failure. */
+    typedef std::function<bool(const cv::Mat &frame, uint64_t &objects, std::string &error)> Worker;
+
+    std::vector<std::string> split(const std::string &text, char separator)
+    {
+        std::vector<std::string> parts;
+        std::stringstream stream(text);
+        std::string part;
+        while (std::getline(stream, part, separator))
+        {
+            if (!part.empty())
+                parts.push_back(part);
+        }
+        return parts;
+    }
+
+    std::vector<int> parseInts(const std::string &text)
+    {
+        std::vector<int> values;
+        for (const std::string &part : split(text, ','))
+            values.push_back(std::stoi(part));
+        return values;
+    }
+
+    std::vector<cv::Size> parseResolutions(const std::string &text)
+    {
+        std::vector<cv::Size> sizes;
+        for (const std::string &part : split(text, ','))
+        {
+            const size_t x = part.find('x');
+            if (x == std::string::npos)
+                throw std::invalid_argument("resolution must be WIDTHxHEIGHT: " + part);
+            sizes.push_back(cv::Size(std::stoi(part.substr(0, x)), std::stoi(part.substr(x + 1))));
+        }
+        return sizes;
+    }
+
+    void usage(const char *program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --images DIR            benchmark on the images of DIR (resized to each resolution) instead of synthetic frames\n"
+                  << "  --output FILE           write the JSON report to FILE instead of stdout\n"
+                  << "  --work-dir DIR          directory for the generated models (default benchmark-models)\n"
+                  << "  --suites LIST           any of yolo,onnx,color,pipeline (default all)\n"
+                  << "  --resolutions LIST      e.g. 640x480,1920x1080\n"
+                  << "  --partitions LIST       darknet partition counts, 0 disables partitioning (default 0,2,4)\n"
+                  << "  --color-ranges LIST     number of color ranges (default 1,2,4)\n"
+                  << "  --threads LIST          concurrent detector/pipeline instances (default 1,2,4)\n"
+                  << "  --pipeline-detector D   yolo or onnx (default yolo)\n"
+                  << "  --frames N              timed frames per instance (default 30)\n"
+                  << "  --warmup N              untimed frames per instance (default 3)\n"
+                  << "  --classes N             classes of the generated models (default 3)\n"
+                  << "  --seed N                seed of the generated models and frames (default 1)\n"
+                  << "  --no-fork               run every case in this process (peak RSS is then cumulative)\n";
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        try
+        {
+            for (int i = 1; i < argc; i++)
+            {
+                const std::string argument = argv[i];
+                auto value = [&]() -> std::string
+                {
+                    if (i + 1 >= argc)
+                        throw std::invalid_argument(argument + " needs a value");
+                    return argv[++i];
+                };
+                if (argument == "--images")
+                    options.imageDirectory = value();
+                else if (argument == "--output")
+                    options.outputFile = value();
+                else if (argument == "--work-dir")
+                    options.workDirectory = value();
+                else if (argument == "--suites")
+                    options.suites = split(value(), ',');
+                else if (argument == "--resolutions")
+                    options.resolutions = parseResolutions(value());
+                else if (argument == "--partitions")
+                    options.partitions = parseInts(value());
+                else if (argument == "--color-ranges")
+                    options.colorRanges = parseInts(value());
+                else if (argument == "--threads")
+                    options.threads = parseInts(value());
+                else if (argument == "--pipeline-detector")
+                    options.pipelineDetector = value();
+                else if (argument == "--frames")
+                    options.frames = std::stoi(value());
+                else if (argument == "--warmup")
+                    options.warmup = std::stoi(value());
+                else if (argument == "--classes")
+                    options.classes = std::stoi(value());
+                else if (argument == "--seed")
+                    options.seed = static_cast<unsigned>(std::stoul(value()));
+                else if (argument == "--no-fork")
+                    options.fork = false;
+                else
+                {
+                    usage(argv[0]);
+                    return false;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Invalid arguments: " << e.what() << "\n";
+            usage(argv[0]);
+            return false;
+        }
+        if (options.frames <= 0 || options.warmup < 0 || options.resolutions.empty() || options.threads.empty())
+        {
+            usage(argv[0]);
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<Case> buildCases(const Options &options)
+    {
+        // Only the dimensions a suite depends on are swept.
+        const std::vector<int> noPartitions = {0};
+        const std::vector<int> noColorRanges = {0};
+        std::vector<Case> cases;
+        for (const std::string &suite : options.suites)
+        {
+            const bool usesPartitions = suite == "yolo" || (suite == "pipeline" && options.pipelineDetector == "yolo");
+            const bool usesColor = suite == "color" || suite == "pipeline";
+            for (const cv::Size &resolution : options.resolutions)
+                for (int partitions : usesPartitions ? options.partitions : noPartitions)
+                    for (int colorRanges : usesColor ? options.colorRanges : noColorRanges)
+                        for (int threads : options.threads)
+                            cases.push_back({suite, resolution, partitions, colorRanges, threads});
+        }
+        return cases;
+    }
+
+    bool loadFrames(const Options &options, const cv::Size &resolution, std::vector<cv::Mat> &frames, std::string &error)
+    {
+        if (options.imageDirectory.empty())
+        {
+            SyntheticData::frames(resolution, options.frames, options.seed, frames);
+            return true;
+        }
+
+        std::vector<std::string> paths;
+        for (const auto &entry : fs::directory_iterator(options.imageDirectory))
+        {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() && (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp"))
+                paths.push_back(entry.path().string());
+        }
+        std::sort(paths.begin(), paths.end());
+        for (const std::string &path : paths)
+        {
+            if (static_cast<int>(frames.size()) >= options.frames)
+                break;
+            cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+            if (image.empty())
+                continue;
+            cv::Mat resized;
+            cv::resize(image, resized, resolution, 0, 0, cv::INTER_AREA);
+            frames.push_back(resized);
+        }
+        if (frames.empty())
+        {
+            error = "No readable images in " + options.imageDirectory;
+            return false;
+        }
+        return true;
+    }
+
+    DetectionLibrary::PartitionDetectionConfigurationParameter partitionParameters(int partitions)
+    {
+        DetectionLibrary::PartitionDetectionConfigurationParameter parameters;
+        parameters.partitionFlag = partitions > 0;
+        parameters.numberOfPartitions = partitions;
+        for (int i = 0; i < partitions; i++)
+            parameters.partitionToDetect.push_back(i);
+        return parameters;
+    }
+
+    DetectionLibrary::ColorConfigurationParameters colorParameters(int colorRanges)
+    {
+        DetectionLibrary::ColorConfigurationParameters parameters;
+        parameters.colorRanges = SyntheticData::colorRanges(colorRanges);
+        parameters.minContourSize = 200;
+        parameters.maxContourSize = std::numeric_limits<int>::max();
+        return parameters;
+    }
+
+    /** @brief Write the synthetic models the selected suites need, once for all cases. */
+    bool writeModels(const Options &options, Models &models, std::string &error)
+    {
+        SyntheticData::ModelParameters model;
+        model.classes = options.classes;
+        model.inputSize = options.darknetInputSize;
+        model.seed = options.seed;
+
+        for (DetectionLibrary::DetectionConfigurationParameter *parameters : {&models.yolo, &models.onnx})
+        {
+            parameters->nms = 0.45f;
+            parameters->thresh = 0.5f;
+            parameters->threshHeir = 0.5f;
+        }
+        const fs::path directory(options.workDirectory);
+        return SyntheticData::writeDarknetModel((directory / "yolo").string(), model, models.yolo, error) &&
+               SyntheticData::writeOnnxModel((directory / "onnx").string(), model, models.onnx, error);
+    }
+
+    bool createWorker(const Options &options, const Models &models, const Case &benchmarkCase, Worker &worker, std::string &error)
+    {
+        const DetectionLibrary::PartitionDetectionConfigurationParameter partitions = partitionParameters(benchmarkCase.partitions);
+
+        if (benchmarkCase.suite == "yolo" || benchmarkCase.suite == "onnx")
+        {
+            const DetectionLibrary::DetectionConfigurationParameter &parameters = benchmarkCase.suite == "onnx" ? models.onnx : models.yolo;
+            std::shared_ptr<DetectionLibrary> detector(detectionSelector::generateDetection(
+                benchmarkCase.suite == "onnx" ? detectionSelector::onnx : detectionSelector::ObjectDetector));
+            if (!detector || !detector->configuration(parameters, partitions))
+            {
+                error = "Configuration of the " + benchmarkCase.suite + " detector failed.";
+                return false;
+            }
+            worker = [detector](const cv::Mat &frame, uint64_t &objects, std::string &message)
+            {
+                std::map<int, std::vector<std::pair<cv::Rect, float>>> results;
+                int count = 0;
+                cv::Mat image = frame;
+                if (!detector->detect(image, results, count))
+                {
+                    message = "Object detection failed.";
+                    return false;
+                }
+                objects += count;
+                return true;
+            };
+            return true;
+        }
+
+        if (benchmarkCase.suite == "color")
+        {
+            std::shared_ptr<DetectionLibrary> detector(detectionSelector::generateDetection(detectionSelector::InRangeDetection));
+            if (!detector->configuration(colorParameters(benchmarkCase.colorRanges), partitions, 10, 10))
+            {
+                error = "Configuration of the color detector failed.";
+                return false;
+            }
+            worker = [detector](const cv::Mat &frame, uint64_t &objects, std::string &message)
+            {
+                std::vector<cv::Rect> boxes;
+                int count = 0;
+                cv::Mat image = frame;
+                if (!detector->detect(image, count, boxes))
+                {
+                    message = "Color detection failed.";
+                    return false;
+                }
+                objects += count;
+                return true;
+            };
+            return true;
+        }
+
+        if (benchmarkCase.suite == "pipeline")
+        {
+            const DetectionLibrary::DetectionConfigurationParameter &parameters = options.pipelineDetector == "onnx" ? models.onnx : models.yolo;
+            std::shared_ptr<NetraVision> pipeline = std::make_shared<NetraVision>();
+            const NetraVision::DetectionObject method = options.pipelineDetector == "onnx" ? NetraVision::Onnx : NetraVision::ObjectDetection;
+            if (!pipeline->detectionConfiguration(method, parameters, partitions, error) ||
+                !pipeline->colorConfiguration(NetraVision::ColorInRangeDetection, colorParameters(benchmarkCase.colorRanges), partitions, 10, 10, error))
+                return false;
+            worker = [pipeline](const cv::Mat &frame, uint64_t &objects, std::string &message)
+            {
+                std::map<int, std::vector<std::pair<cv::Rect, float>>> results;
+                std::vector<cv::Rect> colorBoxes;
+                int objectCount = 0, colorCount = 0;
+                pipeline->detectNetraVision(frame, results, objectCount, colorBoxes, colorCount, true, true, message);
+                objects += std::max(objectCount, 0) + std::max(colorCount, 0);
+                return message.empty();
+            };
+            return true;
+        }
+
+        error = "Unknown suite " + benchmarkCase.suite;
+        return false;
+    }
+
+    double percentile(const std::vector<double> &sorted, double quantile)
+    {
+        if (sorted.empty())
+            return 0;
+        const size_t index = static_cast<size_t>(std::ceil(quantile * sorted.size())) - 1;
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    long peakRssKb()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    /** @brief Run one case and return its JSON object. */
+    std::string runCase(const Options &options, const Models &models, const Case &benchmarkCase)
+    {
+        std::ostringstream json;
+        json << "{\"suite\":" << Json::quote(benchmarkCase.suite)
+             << ",\"width\":" << benchmarkCase.resolution.width << ",\"height\":" << benchmarkCase.resolution.height
+             << ",\"partitions\":" << benchmarkCase.partitions << ",\"colorRanges\":" << benchmarkCase.colorRanges
+             << ",\"threads\":" << benchmarkCase.threads;
+
+        auto fail = [&](const std::string &error)
+        {
+            json << ",\"ok\":false,\"error\":" << Json::quote(error) << ",\"peakRssKb\":" << peakRssKb() << "}";
+            return json.str();
+        };
+
+        std::string error;
+        std::vector<cv::Mat> frames;
+        if (!loadFrames(options, benchmarkCase.resolution, frames, error))
+            return fail(error);
+
+        std::vector<Worker> workers(benchmarkCase.threads);
+        for (Worker &worker : workers)
+        {
+            if (!createWorker(options, models, benchmarkCase, worker, error))
+                return fail(error);
+        }
+
+        for (Worker &worker : workers)
+        {
+            uint64_t objects = 0;
+            for (int i = 0; i < options.warmup; i++)
+            {
+                if (!worker(frames[i % frames.size()], objects, error))
+                    return fail(error);
+            }
+        }
+        StageMetrics::reset();
+
+        // Every instance detects every frame; instances run concurrently.
+        std::vector<std::vector<double>> latencies(workers.size());
+        std::vector<std::string> errors(workers.size());
+        std::vector<uint64_t> objects(workers.size(), 0);
+        std::atomic<int> ready(0);
+        std::atomic<bool> start(false);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers.size(); w++)
+        {
+            threads.emplace_back([&, w]()
+            {
+                latencies[w].reserve(frames.size());
+                ready++;
+                while (!start.load())
+                    std::this_thread::yield();
+                for (const cv::Mat &frame : frames)
+                {
+                    const auto begin = std::chrono::steady_clock::now();
+                    const bool ok = workers[w](frame, objects[w], errors[w]);
+                    latencies[w].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+                    if (!ok)
+                        break;
+                }
+            });
+        }
+        while (ready.load() < static_cast<int>(workers.size()))
+            std::this_thread::yield();
+        const auto begin = std::chrono::steady_clock::now();
+        start = true;
+        for (std::thread &thread : threads)
+            thread.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        for (const std::string &workerError : errors)
+        {
+            if (!workerError.empty())
+                return fail(workerError);
+        }
+
+        std::vector<double> all;
+        uint64_t totalObjects = 0;
+        for (size_t w = 0; w < workers.size(); w++)
+        {
+            all.insert(all.end(), latencies[w].begin(), latencies[w].end());
+            totalObjects += objects[w];
+        }
+        std::sort(all.begin(), all.end());
+        double sum = 0;
+        for (double latency : all)
+            sum += latency;
+
+        json << std::fixed << std::setprecision(3)
+             << ",\"ok\":true,\"frames\":" << all.size()
+             << ",\"seconds\":" << seconds
+             << ",\"fps\":" << (seconds > 0 ? all.size() / seconds : 0)
+             << ",\"latencyMs\":{\"mean\":" << sum / all.size() << ",\"p50\":" << percentile(all, 0.5)
+             << ",\"p99\":" << percentile(all, 0.99) << ",\"max\":" << all.back() << "}"
+             << ",\"objectsPerFrame\":" << static_cast<double>(totalObjects) / all.size()
+             << ",\"peakRssKb\":" << peakRssKb() << ",\"stages\":[";
+        const StageMetrics::Snapshot stages = StageMetrics::snapshot();
+        for (size_t i = 0; i < stages.stages.size(); i++)
+        {
+            const StageMetrics::StageSnapshot &stage = stages.stages[i];
+            json << (i ? "," : "") << "{\"name\":" << Json::quote(stage.name) << ",\"count\":" << stage.count
+                 << ",\"meanUs\":" << stage.mean / 1000.0 << ",\"p50Us\":" << stage.p50 / 1000.0
+                 << ",\"p99Us\":" << stage.p99 / 1000.0 << ",\"maxUs\":" << stage.max / 1000.0 << "}";
+        }
+        json << "]}";
+        return json.str();
+    }
+
+    /** @brief Run a case in a child process and collect its JSON from a pipe. */
+    std::string runCaseIsolated(const Options &options, const Models &models, const Case &benchmarkCase)
+    {
+        int channel[2];
+        if (pipe(channel) != 0)
+            return runCase(options, models, benchmarkCase);
+
+        const pid_t child = fork();
+        if (child == 0)
+        {
+            close(channel[0]);
+            const std::string result = runCase(options, models, benchmarkCase);
+            size_t written = 0;
+            while (written < result.size())
+            {
+                const ssize_t n = write(channel[1], result.data() + written, result.size() - written);
+                if (n <= 0)
+                    break;
+                written += n;
+            }
+            close(channel[1]);
+            _exit(0);
+        }
+        close(channel[1]);
+        if (child < 0)
+        {
+            close(channel[0]);
+            return runCase(options, models, benchmarkCase);
+        }
+
+        std::string result;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(channel[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+        {
+            if (n > 0)
+                result.append(buffer, n);
+        }
+        close(channel[0]);
+
+        int status = 0;
+        rusage usage;
+        wait4(child, &status, 0, &usage);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && !result.empty())
+            return result;
+
+        std::ostringstream json;
+        json << "{\"suite\":" << Json::quote(benchmarkCase.suite)
+             << ",\"width\":" << benchmarkCase.resolution.width << ",\"height\":" << benchmarkCase.resolution.height
+             << ",\"partitions\":" << benchmarkCase.partitions << ",\"colorRanges\":" << benchmarkCase.colorRanges
+             << ",\"threads\":" << benchmarkCase.threads << ",\"ok\":false,\"error\":"
+             << Json::quote(WIFSIGNALED(status) ? std::string("terminated by signal ") + strsignal(WTERMSIG(status)) : "benchmark process failed")
+             << ",\"peakRssKb\":" << usage.ru_maxrss << "}";
+        return json.str();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    Models models;
+    std::string error;
+    if (!writeModels(options, models, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    const std::vector<Case> cases = buildCases(options);
+    std::vector<std::string> results;
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        const Case &benchmarkCase = cases[i];
+        std::cerr << "[" << i + 1 << "/" << cases.size() << "] " << benchmarkCase.suite << " "
+                  << benchmarkCase.resolution.width << "x" << benchmarkCase.resolution.height
+                  << " partitions=" << benchmarkCase.partitions << " colorRanges=" << benchmarkCase.colorRanges
+                  << " threads=" << benchmarkCase.threads << std::endl;
+        results.push_back(options.fork ? runCaseIsolated(options, models, benchmarkCase) : runCase(options, models, benchmarkCase));
+    }
+
+    char timestamp[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::ostringstream report;
+    report << "{\n  \"timestamp\": " << Json::quote(timestamp)
+           << ",\n  \"host\": {\"hardwareThreads\": " << std::thread::hardware_concurrency()
+           << ", \"opencv\": " << Json::quote(CV_VERSION) << "}"
+           << ",\n  \"options\": {\"source\": " << Json::quote(options.imageDirectory.empty() ? "synthetic" : options.imageDirectory)
+           << ", \"frames\": " << options.frames << ", \"warmup\": " << options.warmup
+           << ", \"classes\": " << options.classes << ", \"seed\": " << options.seed
+           << ", \"pipelineDetector\": " << Json::quote(options.pipelineDetector)
+           << ", \"partitions\": " << Json::array(options.partitions) << ", \"colorRanges\": " << Json::array(options.colorRanges)
+           << ", \"threads\": " << Json::array(options.threads) << ", \"isolated\": " << (options.fork ? "true" : "false") << "}"
+           << ",\n  \"cases\": [";
+    for (size_t i = 0; i < results.size(); i++)
+        report << (i ? "," : "") << "\n    " << results[i];
+    report << "\n  ]\n}\n";
+
+    if (options.outputFile.empty())
+    {
+        std::cout << report.str();
+    }
+    else
+    {
+        std::ofstream file(options.outputFile, std::ios::trunc);
+        file << report.str();
+        if (!file)
+        {
+            std::cerr << "Cannot write " << options.outputFile << "\n";
+            return 1;
+        }
+    }
+
+    bool allOk = true;
+    for (const std::string &result : results)
+        allOk = allOk && result.find("\"ok\":true") != std::string::npos;
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,764 @@
+#include "syntheticData.H"
+#include "json.H"
+#include "frameIngestion.H"
+#include "detectionSelector.H"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <thread>
+
+/**
+ * Golden-result regression harness of the detectors.
+ *
+ * Record mode runs Yolo, Onnx and ColorInRangeDetection over a frame set and writes their
+ * detections (class, box, score) and timing to a golden file. Compare mode replays the
+ * recording with the same models, frames and thresholds and fails on accuracy drift beyond
+ * the IoU/score tolerances or on a slowdown beyond a threshold. The models are the small
+ * synthetic ones of SyntheticData and the frames are synthetic unless --images is given,
+ * so a recording replays offline. Typical use: record on the baseline, compare after a
+ * performance change on the same machine; latency is only comparable there, so the
+ * performance gate is this manual run. Tools/golden/synthetic.golden, recorded by the
+ * golden_baseline build target, is the accuracy baseline of the golden_compare test.
+ *
+ * The golden file is line based so it diffs well:
+ *   netravision-golden 2
+ *   config <seed> <frames> <width> <height> <classes> <darknetInput> <colorRanges> <thresh> <nms> <objectBias>
+ *   source <synthetic | image directory>
+ *   suite <name> <medianMs> <p90Ms>      (0 ms: timing not recorded, compared for accuracy only)
+ *   frame <index>
+ *   object <class> <x> <y> <width> <height> <score>
+ * Lines starting with # are comments. Version 1 files have no objectBias, it was 0.
+ */
+namespace
+{
+    /** @brief Everything a replay must reproduce, stored in the golden file. */
+    struct Recording
+    {
+        unsigned seed = 1;
+        int frames = 8;
+        cv::Size resolution = cv::Size(640, 480); ///< Synthetic frames only.
+        int classes = 3;
+        int darknetInputSize = 416;
+        int colorRanges = 2;
+        float thresh = 0.5f;
+        float nms = 0.45f;
+        float objectBias = -6.f;                  ///< Of the synthetic models: a few confident boxes instead of hundreds near thresh.
+        std::string source = "synthetic";         ///< Or the image directory.
+    };
+
+    struct Options
+    {
+        std::string mode = "compare";
+        std::string goldenFile = "netravision.golden";
+        std::string outputFile;                 ///< Empty: stdout.
+        std::string workDirectory = "golden-models";
+        std::vector<std::string> suites = {"yolo", "onnx", "color"};
+        Recording recording;                    ///< Record mode; compare mode takes it from the golden file.
+        int warmup = 2;
+        int repeats = 3;                        ///< Timed passes over the frames.
+        float iou = 0.9f;
+        float scoreTolerance = 0.01f;
+        double maxSlowdown = 1.25;              ///< Median latency ratio to the golden one, 0 disables the check.
+        double slackMs = 0.5;                   ///< Absolute latency allowance, keeps sub-millisecond suites stable.
+        size_t maxMismatches = 20;              ///< Mismatches listed per suite in the report.
+    };
+
+    typedef std::map<int, std::vector<std::pair<cv::Rect, float>>> Detections;
+
+    const int minBoxSide = 4; ///< Slimmer boxes are not recorded, a pixel of rounding changes their IoU too much.
+
+    struct SuiteRecord
+    {
+        std::string suite;
+        std::vector<Detections> frames;
+        double medianMs = 0;
+        double p90Ms = 0;
+    };
+
+    struct Golden
+    {
+        Recording recording;
+        std::vector<SuiteRecord> suites;
+    };
+
+    struct Comparison
+    {
+        uint64_t goldenObjects = 0;
+        uint64_t objects = 0;
+        uint64_t matched = 0;
+        uint64_t missing = 0;
+        uint64_t extra = 0;
+        uint64_t scoreDrift = 0;
+        double minIou = 1;
+        double maxScoreDelta = 0;
+        std::vector<std::string> mismatches; ///< JSON objects.
+    };
+
+    /** @brief Detects one frame, returns false with error set on failure. */
+    typedef std::function<bool(const cv::Mat &frame, Detections &detections, std::string &error)> Detector;
+
+    std::vector<std::string> split(const std::string &text, char separator)
+    {
+        std::vector<std::string> parts;
+        std::stringstream stream(text);
+        std::string part;
+        while (std::getline(stream, part, separator))
+        {
+            if (!part.empty())
+                parts.push_back(part);
+        }
+        return parts;
+    }
+
+    cv::Size parseResolution(const std::string &text)
+    {
+        const size_t x = text.find('x');
+        if (x == std::string::npos)
+            throw std::invalid_argument("resolution must be WIDTHxHEIGHT: " + text);
+        return cv::Size(std::stoi(text.substr(0, x)), std::stoi(text.substr(x + 1)));
+    }
+
+    void usage(const char *program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --mode M                record or compare (default compare)\n"
+                  << "  --golden FILE           golden file (default netravision.golden)\n"
+                  << "  --output FILE           write the JSON report to FILE instead of stdout\n"
+                  << "  --work-dir DIR          directory for the generated models (default golden-models)\n"
+                  << "  --suites LIST           any of yolo,onnx,color (default all that are built)\n"
+                  << "  --warmup N              untimed frames per suite (default 2)\n"
+                  << "  --repeats N             timed passes over the frames (default 3)\n"
+                  << "  --iou X                 IoU for a detection to match its golden one (default 0.9)\n"
+                  << "  --score-tolerance X     largest score change of a matched detection (default 0.01)\n"
+                  << "  --max-slowdown X        largest median latency ratio to the golden run, 0 disables (default 1.25)\n"
+                  << "  --slack-ms X            latency allowance on top of the ratio (default 0.5)\n"
+                  << "Recording (record mode only, compare replays the golden file's):\n"
+                  << "  --images DIR            record on the images of DIR instead of synthetic frames\n"
+                  << "  --frames N              frames (default 8)\n"
+                  << "  --resolution WxH        synthetic frame size (default 640x480)\n"
+                  << "  --classes N             classes of the generated models (default 3)\n"
+                  << "  --darknet-input N       darknet network size, a multiple of 32 (default 416)\n"
+                  << "  --color-ranges N        color ranges of the color detector (default 2)\n"
+                  << "  --thresh X              detection threshold (default 0.5)\n"
+                  << "  --nms X                 NMS overlap (default 0.45)\n"
+                  << "  --object-bias X         objectness bias of the generated models (default -6)\n"
+                  << "  --seed N                seed of the generated models and frames (default 1)\n";
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        try
+        {
+            for (int i = 1; i < argc; i++)
+            {
+                const std::string argument = argv[i];
+                auto value = [&]() -> std::string
+                {
+                    if (i + 1 >= argc)
+                        throw std::invalid_argument(argument + " needs a value");
+                    return argv[++i];
+                };
+                if (argument == "--mode")
+                    options.mode = value();
+                else if (argument == "--golden")
+                    options.goldenFile = value();
+                else if (argument == "--output")
+                    options.outputFile = value();
+                else if (argument == "--work-dir")
+                    options.workDirectory = value();
+                else if (argument == "--suites")
+                    options.suites = split(value(), ',');
+                else if (argument == "--warmup")
+                    options.warmup = std::stoi(value());
+                else if (argument == "--repeats")
+                    options.repeats = std::stoi(value());
+                else if (argument == "--iou")
+                    options.iou = std::stof(value());
+                else if (argument == "--score-tolerance")
+                    options.scoreTolerance = std::stof(value());
+                else if (argument == "--max-slowdown")
+                    options.maxSlowdown = std::stod(value());
+                else if (argument == "--slack-ms")
+                    options.slackMs = std::stod(value());
+                else if (argument == "--images")
+                    options.recording.source = value();
+                else if (argument == "--frames")
+                    options.recording.frames = std::stoi(value());
+                else if (argument == "--resolution")
+                    options.recording.resolution = parseResolution(value());
+                else if (argument == "--classes")
+                    options.recording.classes = std::stoi(value());
+                else if (argument == "--darknet-input")
+                    options.recording.darknetInputSize = std::stoi(value());
+                else if (argument == "--color-ranges")
+                    options.recording.colorRanges = std::stoi(value());
+                else if (argument == "--thresh")
+                    options.recording.thresh = std::stof(value());
+                else if (argument == "--nms")
+                    options.recording.nms = std::stof(value());
+                else if (argument == "--object-bias")
+                    options.recording.objectBias = std::stof(value());
+                else if (argument == "--seed")
+                    options.recording.seed = static_cast<unsigned>(std::stoul(value()));
+                else
+                {
+                    usage(argv[0]);
+                    return false;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Invalid arguments: " << e.what() << "\n";
+            usage(argv[0]);
+            return false;
+        }
+        if ((options.mode != "record" && options.mode != "compare") || options.recording.frames <= 0 ||
+            options.warmup < 0 || options.repeats <= 0 || options.suites.empty())
+        {
+            usage(argv[0]);
+            return false;
+        }
+        return true;
+    }
+
+    bool writeGolden(const std::string &path, const Golden &golden, std::string &error)
+    {
+        const Recording &recording = golden.recording;
+        std::ostringstream out;
+        out << "netravision-golden 2\n"
+            << "config " << recording.seed << " " << recording.frames << " " << recording.resolution.width << " "
+            << recording.resolution.height << " " << recording.classes << " " << recording.darknetInputSize << " "
+            << recording.colorRanges << " " << recording.thresh << " " << recording.nms << " " << recording.objectBias << "\n"
+            << "source " << recording.source << "\n";
+        out << std::fixed;
+        for (const SuiteRecord &suite : golden.suites)
+        {
+            out << std::setprecision(3) << "suite " << suite.suite << " " << suite.medianMs << " " << suite.p90Ms << "\n";
+            out << std::setprecision(6);
+            for (size_t i = 0; i < suite.frames.size(); i++)
+            {
+                out << "frame " << i << "\n";
+                for (const auto &objects : suite.frames[i])
+                {
+                    for (const auto &object : objects.second)
+                    {
+                        const cv::Rect &box = object.first;
+                        out << "object " << objects.first << " " << box.x << " " << box.y << " " << box.width << " "
+                            << box.height << " " << object.second << "\n";
+                    }
+                }
+            }
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        file << out.str();
+        if (!file)
+        {
+            error = "Cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool readGolden(const std::string &path, Golden &golden, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "Cannot read " + path + ", record it first with --mode record";
+            return false;
+        }
+
+        std::string line;
+        int lineNumber = 0;
+        auto fail = [&](const std::string &message)
+        {
+            error = path + ":" + std::to_string(lineNumber) + ": " + message;
+            return false;
+        };
+        SuiteRecord *suite = nullptr;
+        Detections *frame = nullptr;
+        int version = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            std::istringstream fields(line);
+            std::string kind;
+            if (!(fields >> kind) || kind[0] == '#')
+                continue;
+
+            if (kind == "netravision-golden")
+            {
+                if (!(fields >> version) || version < 1 || version > 2)
+                    return fail("unsupported golden file version");
+            }
+            else if (kind == "config")
+            {
+                Recording &recording = golden.recording;
+                if (!(fields >> recording.seed >> recording.frames >> recording.resolution.width >> recording.resolution.height >>
+                      recording.classes >> recording.darknetInputSize >> recording.colorRanges >> recording.thresh >> recording.nms))
+                    return fail("invalid config line");
+                recording.objectBias = 0.f;
+                if (version >= 2 && !(fields >> recording.objectBias))
+                    return fail("invalid config line");
+            }
+            else if (kind == "source")
+            {
+                std::getline(fields >> std::ws, golden.recording.source);
+            }
+            else if (kind == "suite")
+            {
+                golden.suites.emplace_back();
+                suite = &golden.suites.back();
+                frame = nullptr;
+                if (!(fields >> suite->suite >> suite->medianMs >> suite->p90Ms))
+                    return fail("invalid suite line");
+            }
+            else if (kind == "frame")
+            {
+                size_t index = 0;
+                if (suite == nullptr || !(fields >> index) || index != suite->frames.size())
+                    return fail("frame out of order");
+                suite->frames.emplace_back();
+                frame = &suite->frames.back();
+            }
+            else if (kind == "object")
+            {
+                int classId = 0;
+                cv::Rect box;
+                float score = 0;
+                if (frame == nullptr || !(fields >> classId >> box.x >> box.y >> box.width >> box.height >> score))
+                    return fail("invalid object line");
+                (*frame)[classId].push_back(std::make_pair(box, score));
+            }
+            else
+            {
+                return fail("unknown line " + kind);
+            }
+        }
+        if (golden.suites.empty())
+        {
+            error = path + " has no suites";
+            return false;
+        }
+        return true;
+    }
+
+    bool loadFrames(const Recording &recording, std::vector<cv::Mat> &frames, std::string &error)
+    {
+        if (recording.source == "synthetic")
+        {
+            SyntheticData::frames(recording.resolution, recording.frames, recording.seed, frames);
+            return true;
+        }
+
+        FrameIngestion ingestion;
+        FrameIngestion::Parameters parameters;
+        if (!ingestion.openDirectory(recording.source, parameters, error))
+            return false;
+        FrameIngestion::Frame frame;
+        while (static_cast<int>(frames.size()) < recording.frames && ingestion.next(frame))
+        {
+            if (frame.error.empty())
+                frames.push_back(frame.image.clone());
+            ingestion.release(frame);
+        }
+        if (static_cast<int>(frames.size()) < recording.frames)
+        {
+            error = "Fewer than " + std::to_string(recording.frames) + " readable images in " + recording.source;
+            return false;
+        }
+        return true;
+    }
+
+    /** @brief Classes and boxes in a fixed order, so equal results are written identically; slivers dropped. */
+    void canonicalize(Detections &detections)
+    {
+        for (auto &objects : detections)
+        {
+            objects.second.erase(std::remove_if(objects.second.begin(), objects.second.end(), [](const auto &object)
+            {
+                return std::min(object.first.width, object.first.height) < minBoxSide;
+            }), objects.second.end());
+            std::sort(objects.second.begin(), objects.second.end(), [](const auto &a, const auto &b)
+            {
+                if (a.second != b.second)
+                    return a.second > b.second;
+                const cv::Rect &x = a.first, &y = b.first;
+                return std::tie(x.x, x.y, x.width, x.height) < std::tie(y.x, y.y, y.width, y.height);
+            });
+        }
+        for (auto objects = detections.begin(); objects != detections.end();)
+            objects = objects->second.empty() ? detections.erase(objects) : std::next(objects);
+    }
+
+    /**
+     * @brief Detector of a suite with the synthetic model of the recording.
+     * @param unavailable Set when the suite's backend was not built in.
+     */
+    bool createDetector(const std::string &suite, const Recording &recording, const std::string &workDirectory, Detector &detector, bool &unavailable, std::string &error)
+    {
+        unavailable = false;
+        const DetectionLibrary::PartitionDetectionConfigurationParameter noPartitions;
+        if (suite == "color")
+        {
+            std::shared_ptr<DetectionLibrary> color(detectionSelector::generateDetection(detectionSelector::InRangeDetection));
+            DetectionLibrary::ColorConfigurationParameters parameters;
+            parameters.colorRanges = SyntheticData::colorRanges(recording.colorRanges);
+            parameters.minContourSize = 200;
+            parameters.maxContourSize = std::numeric_limits<int>::max();
+            if (!color || !color->configuration(parameters, noPartitions, 10, 10))
+            {
+                error = "Configuration of the color detector failed.";
+                return false;
+            }
+            // Color boxes carry no class or score: class 0, score 1.
+            detector = [color](const cv::Mat &frame, Detections &detections, std::string &message)
+            {
+                std::vector<cv::Rect> boxes;
+                int count = 0;
+                cv::Mat image = frame;
+                if (!color->detect(image, count, boxes))
+                {
+                    message = "Color detection failed.";
+                    return false;
+                }
+                for (const cv::Rect &box : boxes)
+                    detections[0].push_back(std::make_pair(box, 1.f));
+                return true;
+            };
+            return true;
+        }
+
+        if (suite != "yolo" && suite != "onnx")
+        {
+            error = "Unknown suite " + suite;
+            return false;
+        }
+        std::shared_ptr<DetectionLibrary> object(detectionSelector::generateDetection(suite == "onnx" ? detectionSelector::onnx : detectionSelector::ObjectDetector));
+        if (!object)
+        {
+            unavailable = true;
+            error = "The " + suite + " detector is not built in.";
+            return false;
+        }
+
+        SyntheticData::ModelParameters model;
+        model.classes = recording.classes;
+        model.inputSize = recording.darknetInputSize;
+        model.seed = recording.seed;
+        model.objectBias = recording.objectBias;
+        DetectionLibrary::DetectionConfigurationParameter parameters;
+        parameters.nms = recording.nms;
+        parameters.thresh = recording.thresh;
+        parameters.threshHeir = recording.thresh;
+        const std::string directory = (fs::path(workDirectory) / suite).string();
+        const bool written = suite == "onnx" ? SyntheticData::writeOnnxModel(directory, model, parameters, error)
+                                             : SyntheticData::writeDarknetModel(directory, model, parameters, error);
+        if (!written)
+            return false;
+        if (!object->configuration(parameters, noPartitions))
+        {
+            error = "Configuration of the " + suite + " detector failed.";
+            return false;
+        }
+        detector = [object](const cv::Mat &frame, Detections &detections, std::string &message)
+        {
+            int count = 0;
+            cv::Mat image = frame;
+            if (!object->detect(image, detections, count))
+            {
+                message = "Object detection failed.";
+                return false;
+            }
+            return true;
+        };
+        return true;
+    }
+
+    double percentile(const std::vector<double> &sorted, double quantile)
+    {
+        if (sorted.empty())
+            return 0;
+        const size_t index = static_cast<size_t>(std::ceil(quantile * sorted.size())) - 1;
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    /** @brief Detections of the first pass, latency over all passes. */
+    bool runSuite(Detector &detector, const Options &options, const std::vector<cv::Mat> &frames, SuiteRecord &record, std::string &error)
+    {
+        for (int i = 0; i < options.warmup; i++)
+        {
+            Detections detections;
+            if (!detector(frames[i % frames.size()], detections, error))
+                return false;
+        }
+
+        std::vector<double> latencies;
+        for (int pass = 0; pass < options.repeats; pass++)
+        {
+            for (const cv::Mat &frame : frames)
+            {
+                Detections detections;
+                const auto begin = std::chrono::steady_clock::now();
+                if (!detector(frame, detections, error))
+                    return false;
+                latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+                if (pass == 0)
+                {
+                    canonicalize(detections);
+                    record.frames.push_back(std::move(detections));
+                }
+            }
+        }
+        std::sort(latencies.begin(), latencies.end());
+        record.medianMs = percentile(latencies, 0.5);
+        record.p90Ms = percentile(latencies, 0.9);
+        return true;
+    }
+
+    double iou(const cv::Rect &a, const cv::Rect &b)
+    {
+        const double intersection = (a & b).area();
+        const double unionArea = a.area() + b.area() - intersection;
+        return unionArea > 0 ? intersection / unionArea : 0;
+    }
+
+    std::string mismatchJson(size_t frame, const char *kind, int classId, const cv::Rect &box, float score, double value)
+    {
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(4) << "{\"frame\": " << frame << ", \"kind\": " << Json::quote(kind)
+             << ", \"class\": " << classId << ", \"box\": " << Json::array(std::vector<int>{box.x, box.y, box.width, box.height})
+             << ", \"score\": " << score << ", \"value\": " << value << "}";
+        return json.str();
+    }
+
+    /** @brief Greedy matching per class, highest golden score first. */
+    void compareFrame(size_t frameIndex, const Detections &golden, const Detections &current, const Options &options, Comparison &comparison)
+    {
+        auto note = [&](const std::string &mismatch)
+        {
+            if (comparison.mismatches.size() < options.maxMismatches)
+                comparison.mismatches.push_back(mismatch);
+        };
+
+        std::map<int, std::vector<bool>> used;
+        for (const auto &objects : current)
+        {
+            comparison.objects += objects.second.size();
+            used[objects.first].assign(objects.second.size(), false);
+        }
+
+        for (const auto &objects : golden)
+        {
+            comparison.goldenObjects += objects.second.size();
+            const auto found = current.find(objects.first);
+            for (const auto &object : objects.second)
+            {
+                int best = -1;
+                double bestIou = options.iou;
+                if (found != current.end())
+                {
+                    for (size_t i = 0; i < found->second.size(); i++)
+                    {
+                        const double overlap = iou(object.first, found->second[i].first);
+                        if (!used[objects.first][i] && overlap >= bestIou)
+                        {
+                            best = static_cast<int>(i);
+                            bestIou = overlap;
+                        }
+                    }
+                }
+                if (best < 0)
+                {
+                    comparison.missing++;
+                    note(mismatchJson(frameIndex, "missing", objects.first, object.first, object.second, 0));
+                    continue;
+                }
+                used[objects.first][best] = true;
+                comparison.matched++;
+                comparison.minIou = std::min(comparison.minIou, bestIou);
+                const double delta = std::fabs(found->second[best].second - object.second);
+                comparison.maxScoreDelta = std::max(comparison.maxScoreDelta, delta);
+                if (delta > options.scoreTolerance)
+                {
+                    comparison.scoreDrift++;
+                    note(mismatchJson(frameIndex, "score", objects.first, found->second[best].first, found->second[best].second, delta));
+                }
+            }
+        }
+
+        for (const auto &objects : current)
+        {
+            for (size_t i = 0; i < objects.second.size(); i++)
+            {
+                if (used[objects.first][i])
+                    continue;
+                comparison.extra++;
+                note(mismatchJson(frameIndex, "extra", objects.first, objects.second[i].first, objects.second[i].second, 0));
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    std::string error;
+    Golden golden;
+    const bool record = options.mode == "record";
+    if (!record)
+    {
+        if (!readGolden(options.goldenFile, golden, error))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        options.recording = golden.recording;
+        options.suites.clear();
+        for (const SuiteRecord &suite : golden.suites)
+            options.suites.push_back(suite.suite);
+    }
+
+    std::vector<cv::Mat> frames;
+    if (!loadFrames(options.recording, frames, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    Golden current;
+    current.recording = options.recording;
+    std::vector<std::string> results;
+    bool passed = true;
+    for (const std::string &suite : options.suites)
+    {
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(4) << "{\"suite\": " << Json::quote(suite);
+
+        Detector detector;
+        bool unavailable = false;
+        SuiteRecord run;
+        run.suite = suite;
+        if (!createDetector(suite, options.recording, options.workDirectory, detector, unavailable, error) ||
+            !runSuite(detector, options, frames, run, error))
+        {
+            // A backend that is not built in is skipped, so one recording serves every build.
+            json << ", \"ok\": " << (unavailable ? "true" : "false") << ", \"skipped\": " << (unavailable ? "true" : "false")
+                 << ", \"error\": " << Json::quote(error) << "}";
+            results.push_back(json.str());
+            passed = passed && unavailable;
+            std::cerr << suite << ": " << error << "\n";
+            continue;
+        }
+        json << ", \"medianMs\": " << run.medianMs << ", \"p90Ms\": " << run.p90Ms;
+
+        if (record)
+        {
+            uint64_t objects = 0;
+            for (const Detections &detections : run.frames)
+                for (const auto &classObjects : detections)
+                    objects += classObjects.second.size();
+            json << ", \"ok\": true, \"objects\": " << objects << "}";
+            results.push_back(json.str());
+            current.suites.push_back(std::move(run));
+            continue;
+        }
+
+        const SuiteRecord &reference = *std::find_if(golden.suites.begin(), golden.suites.end(), [&](const SuiteRecord &s) { return s.suite == suite; });
+        if (reference.frames.size() != run.frames.size())
+        {
+            json << ", \"ok\": false, \"error\": " << Json::quote("The golden run has " + std::to_string(reference.frames.size()) + " frames") << "}";
+            results.push_back(json.str());
+            passed = false;
+            continue;
+        }
+        Comparison comparison;
+        for (size_t i = 0; i < run.frames.size(); i++)
+            compareFrame(i, reference.frames[i], run.frames[i], options, comparison);
+
+        const bool accurate = comparison.missing == 0 && comparison.extra == 0 && comparison.scoreDrift == 0;
+        const bool timed = reference.medianMs > 0;
+        const double slowdown = timed ? run.medianMs / reference.medianMs : 0;
+        const bool fast = !timed || options.maxSlowdown <= 0 || run.medianMs <= reference.medianMs * options.maxSlowdown + options.slackMs;
+        passed = passed && accurate && fast;
+
+        json << ", \"goldenMedianMs\": " << reference.medianMs << ", \"slowdown\": " << slowdown
+             << ", \"goldenObjects\": " << comparison.goldenObjects << ", \"objects\": " << comparison.objects
+             << ", \"matched\": " << comparison.matched << ", \"missing\": " << comparison.missing
+             << ", \"extra\": " << comparison.extra << ", \"scoreDrift\": " << comparison.scoreDrift
+             << ", \"minIou\": " << (comparison.matched ? comparison.minIou : 0) << ", \"maxScoreDelta\": " << comparison.maxScoreDelta
+             << ", \"accuracyPassed\": " << (accurate ? "true" : "false") << ", \"timingRecorded\": " << (timed ? "true" : "false")
+             << ", \"timingPassed\": " << (fast ? "true" : "false")
+             << ", \"ok\": " << (accurate && fast ? "true" : "false") << ", \"mismatches\": [";
+        for (size_t i = 0; i < comparison.mismatches.size(); i++)
+            json << (i ? ", " : "") << comparison.mismatches[i];
+        json << "]}";
+        results.push_back(json.str());
+        if (!accurate)
+            std::cerr << suite << ": " << comparison.missing << " missing, " << comparison.extra << " extra, " << comparison.scoreDrift << " score drifts\n";
+        if (!fast)
+            std::cerr << suite << ": median " << run.medianMs << " ms against " << reference.medianMs << " ms recorded\n";
+    }
+
+    if (record)
+    {
+        if (current.suites.empty())
+        {
+            std::cerr << "No suite could be recorded\n";
+            return 1;
+        }
+        if (!writeGolden(options.goldenFile, current, error))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+
+    char timestamp[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(4)
+           << "{\n  \"timestamp\": " << Json::quote(timestamp)
+           << ",\n  \"host\": {\"hardwareThreads\": " << std::thread::hardware_concurrency()
+           << ", \"opencv\": " << Json::quote(CV_VERSION) << "}"
+           << ",\n  \"mode\": " << Json::quote(options.mode) << ", \"golden\": " << Json::quote(options.goldenFile)
+           << ",\n  \"recording\": {\"source\": " << Json::quote(options.recording.source) << ", \"frames\": " << frames.size()
+           << ", \"seed\": " << options.recording.seed << ", \"thresh\": " << options.recording.thresh << ", \"nms\": " << options.recording.nms
+           << ", \"objectBias\": " << options.recording.objectBias << "}"
+           << ",\n  \"tolerances\": {\"iou\": " << options.iou << ", \"score\": " << options.scoreTolerance
+           << ", \"maxSlowdown\": " << options.maxSlowdown << ", \"slackMs\": " << options.slackMs << "}"
+           << ",\n  \"suites\": [";
+    for (size_t i = 0; i < results.size(); i++)
+        report << (i ? "," : "") << "\n    " << results[i];
+    report << "\n  ],\n  \"passed\": " << (passed ? "true" : "false") << "\n}\n";
+
+    if (options.outputFile.empty())
+    {
+        std::cout << report.str();
+    }
+    else
+    {
+        std::ofstream file(options.outputFile, std::ios::trunc);
+        file << report.str();
+        if (!file)
+        {
+            std::cerr << "Cannot write " << options.outputFile << "\n";
+            return 1;
+        }
+    }
+    return passed ? 0 : 1;
+}
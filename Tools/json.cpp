@@ -0,0 +1,20 @@
+#include "json.H"
+
+#include <iomanip>
+
+std::string Json::quote(const std::string &text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
@@ -0,0 +1,441 @@
+#include "syntheticData.H"
+#include "json.H"
+#include "frameIngestion.H"
+#include "onnx.H"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <thread>
+
+/**
+ * Accuracy and speed of an int8 Onnx model against its float original.
+ *
+ * The int8 model is either a quantized ONNX file or the float model calibrated on a folder
+ * of representative images. Both models detect the same frames; int8 detections are matched
+ * to the float ones by class and IoU, and the report gives recall, precision, box and score
+ * drift next to the latency of each model as one JSON document.
+ */
+namespace
+{
+    struct Options
+    {
+        std::string modelFile;            ///< Float ONNX model, empty: synthetic model.
+        std::string namesFile;
+        std::string int8ModelFile;        ///< Quantized ONNX model, empty: calibrate modelFile.
+        std::string calibrationDirectory; ///< Empty with a synthetic model: synthetic frames.
+        std::string imageDirectory;       ///< Evaluation images, empty: synthetic frames.
+        std::string outputFile;           ///< Empty: stdout.
+        std::string workDirectory = "quantization-models";
+        int calibrationImages = 32;
+        int frames = 50;
+        int warmup = 3;
+        float iou = 0.5f;
+        float thresh = 0.5f;
+        float nms = 0.45f;
+        float minRecall = 0.f;
+        unsigned seed = 1;
+    };
+
+    typedef std::map<int, std::vector<std::pair<cv::Rect, float>>> Detections;
+
+    struct Run
+    {
+        std::vector<Detections> detections; ///< Per frame.
+        std::vector<double> latencies;      ///< Milliseconds per frame.
+    };
+
+    struct Accuracy
+    {
+        uint64_t floatObjects = 0;
+        uint64_t int8Objects = 0;
+        uint64_t matched = 0;
+        double iouSum = 0;
+        double scoreDeltaSum = 0;
+    };
+
+    void usage(const char *program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --model FILE              float ONNX model (default: synthetic model in the work directory)\n"
+                  << "  --names FILE              class names of the model\n"
+                  << "  --int8-model FILE         quantized ONNX model (QOperator or QDQ) to compare\n"
+                  << "  --calibration DIR         calibrate the float model to int8 on the images of DIR instead\n"
+                  << "  --calibration-images N    most calibration images used (default 32)\n"
+                  << "  --images DIR              evaluation images (default: synthetic frames)\n"
+                  << "  --output FILE             write the JSON report to FILE instead of stdout\n"
+                  << "  --work-dir DIR            directory for the synthetic model and frames (default quantization-models)\n"
+                  << "  --frames N                most evaluation frames (default 50)\n"
+                  << "  --warmup N                untimed frames per model (default 3)\n"
+                  << "  --iou X                   IoU for an int8 detection to match a float one (default 0.5)\n"
+                  << "  --thresh X                detection threshold (default 0.5)\n"
+                  << "  --nms X                   NMS overlap (default 0.45)\n"
+                  << "  --min-recall X            exit with 1 if fewer float detections are found by int8 (default 0)\n"
+                  << "  --seed N                  seed of the synthetic model and frames (default 1)\n";
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        try
+        {
+            for (int i = 1; i < argc; i++)
+            {
+                const std::string argument = argv[i];
+                auto value = [&]() -> std::string
+                {
+                    if (i + 1 >= argc)
+                        throw std::invalid_argument(argument + " needs a value");
+                    return argv[++i];
+                };
+                if (argument == "--model")
+                    options.modelFile = value();
+                else if (argument == "--names")
+                    options.namesFile = value();
+                else if (argument == "--int8-model")
+                    options.int8ModelFile = value();
+                else if (argument == "--calibration")
+                    options.calibrationDirectory = value();
+                else if (argument == "--calibration-images")
+                    options.calibrationImages = std::stoi(value());
+                else if (argument == "--images")
+                    options.imageDirectory = value();
+                else if (argument == "--output")
+                    options.outputFile = value();
+                else if (argument == "--work-dir")
+                    options.workDirectory = value();
+                else if (argument == "--frames")
+                    options.frames = std::stoi(value());
+                else if (argument == "--warmup")
+                    options.warmup = std::stoi(value());
+                else if (argument == "--iou")
+                    options.iou = std::stof(value());
+                else if (argument == "--thresh")
+                    options.thresh = std::stof(value());
+                else if (argument == "--nms")
+                    options.nms = std::stof(value());
+                else if (argument == "--min-recall")
+                    options.minRecall = std::stof(value());
+                else if (argument == "--seed")
+                    options.seed = static_cast<unsigned>(std::stoul(value()));
+                else
+                {
+                    usage(argv[0]);
+                    return false;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Invalid arguments: " << e.what() << "\n";
+            usage(argv[0]);
+            return false;
+        }
+        if (options.frames <= 0 || options.warmup < 0 || options.calibrationImages <= 0)
+        {
+            usage(argv[0]);
+            return false;
+        }
+        if (!options.modelFile.empty() && options.int8ModelFile.empty() && options.calibrationDirectory.empty())
+        {
+            std::cerr << "--int8-model or --calibration is needed with --model\n";
+            return false;
+        }
+        return true;
+    }
+
+    /** @brief Synthetic model, and synthetic calibration frames if none were given. */
+    bool prepareSynthetic(Options &options, std::string &error)
+    {
+        SyntheticData::ModelParameters model;
+        model.seed = options.seed;
+        DetectionLibrary::DetectionConfigurationParameter parameters;
+        const fs::path directory(options.workDirectory);
+        if (!SyntheticData::writeOnnxModel((directory / "onnx").string(), model, parameters, error))
+            return false;
+        options.modelFile = parameters.weightFile;
+        options.namesFile = parameters.nameFile;
+
+        if (options.int8ModelFile.empty() && options.calibrationDirectory.empty())
+        {
+            const fs::path calibration = directory / "calibration";
+            std::error_code code;
+            fs::create_directories(calibration, code);
+            std::vector<cv::Mat> frames;
+            SyntheticData::frames(cv::Size(640, 480), options.calibrationImages, options.seed, frames);
+            for (size_t i = 0; i < frames.size(); i++)
+            {
+                std::ostringstream name;
+                name << "frame" << std::setw(4) << std::setfill('0') << i << ".png";
+                if (!cv::imwrite((calibration / name.str()).string(), frames[i]))
+                {
+                    error = "Cannot write calibration frames to " + calibration.string();
+                    return false;
+                }
+            }
+            options.calibrationDirectory = calibration.string();
+        }
+        return true;
+    }
+
+    bool loadFrames(const Options &options, std::vector<cv::Mat> &frames, std::string &error)
+    {
+        if (options.imageDirectory.empty())
+        {
+            // A different seed than the calibration frames, so the model is not evaluated on what it was calibrated on.
+            SyntheticData::frames(cv::Size(640, 480), options.frames, options.seed + 1, frames);
+            return true;
+        }
+
+        FrameIngestion ingestion;
+        FrameIngestion::Parameters parameters;
+        if (!ingestion.openDirectory(options.imageDirectory, parameters, error))
+            return false;
+        FrameIngestion::Frame frame;
+        while (static_cast<int>(frames.size()) < options.frames && ingestion.next(frame))
+        {
+            if (frame.error.empty())
+                frames.push_back(frame.image.clone());
+            ingestion.release(frame);
+        }
+        if (frames.empty())
+        {
+            error = "No readable images in " + options.imageDirectory;
+            return false;
+        }
+        return true;
+    }
+
+    bool runModel(Onnx &detector, const Options &options, const std::vector<cv::Mat> &frames, Run &run, std::string &error)
+    {
+        for (int i = 0; i < options.warmup; i++)
+        {
+            Detections detections;
+            int count = 0;
+            cv::Mat image = frames[i % frames.size()];
+            if (!detector.detect(image, detections, count))
+            {
+                error = "Object detection failed.";
+                return false;
+            }
+        }
+
+        for (const cv::Mat &frame : frames)
+        {
+            Detections detections;
+            int count = 0;
+            cv::Mat image = frame;
+            const auto begin = std::chrono::steady_clock::now();
+            if (!detector.detect(image, detections, count))
+            {
+                error = "Object detection failed.";
+                return false;
+            }
+            run.latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+            run.detections.push_back(std::move(detections));
+        }
+        return true;
+    }
+
+    double iou(const cv::Rect &a, const cv::Rect &b)
+    {
+        const double intersection = (a & b).area();
+        const double unionArea = a.area() + b.area() - intersection;
+        return unionArea > 0 ? intersection / unionArea : 0;
+    }
+
+    /** @brief Greedy matching per class, highest int8 score first. */
+    void compare(const Detections &reference, const Detections &candidate, float minimumIou, Accuracy &accuracy)
+    {
+        for (const auto &objects : reference)
+            accuracy.floatObjects += objects.second.size();
+
+        for (const auto &objects : candidate)
+        {
+            accuracy.int8Objects += objects.second.size();
+            const auto found = reference.find(objects.first);
+            if (found == reference.end())
+                continue;
+
+            std::vector<std::pair<cv::Rect, float>> sorted = objects.second;
+            std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+            std::vector<bool> used(found->second.size(), false);
+            for (const auto &object : sorted)
+            {
+                int best = -1;
+                double bestIou = minimumIou;
+                for (size_t i = 0; i < found->second.size(); i++)
+                {
+                    const double overlap = iou(object.first, found->second[i].first);
+                    if (!used[i] && overlap >= bestIou)
+                    {
+                        best = static_cast<int>(i);
+                        bestIou = overlap;
+                    }
+                }
+                if (best < 0)
+                    continue;
+                used[best] = true;
+                accuracy.matched++;
+                accuracy.iouSum += bestIou;
+                accuracy.scoreDeltaSum += std::fabs(object.second - found->second[best].second);
+            }
+        }
+    }
+
+    double percentile(const std::vector<double> &sorted, double quantile)
+    {
+        if (sorted.empty())
+            return 0;
+        const size_t index = static_cast<size_t>(std::ceil(quantile * sorted.size())) - 1;
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    double mean(const std::vector<double> &values)
+    {
+        double sum = 0;
+        for (double value : values)
+            sum += value;
+        return values.empty() ? 0 : sum / values.size();
+    }
+
+    std::string precisionName(Onnx::Precision precision)
+    {
+        switch (precision)
+        {
+        case Onnx::Int8:
+            return "int8";
+        case Onnx::FakeQuantized:
+            return "fake-quantized";
+        default:
+            return "float32";
+        }
+    }
+
+    std::string modelJson(const Onnx &detector, const std::string &source, const Run &run)
+    {
+        std::vector<double> sorted = run.latencies;
+        std::sort(sorted.begin(), sorted.end());
+        const double average = mean(sorted);
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(3)
+             << "{\"source\": " << Json::quote(source) << ", \"precision\": " << Json::quote(precisionName(detector.precision()))
+             << ", \"cuda\": " << (detector.usesCuda() ? "true" : "false")
+             << ", \"fps\": " << (average > 0 ? 1000.0 / average : 0)
+             << ", \"latencyMs\": {\"mean\": " << average << ", \"p50\": " << percentile(sorted, 0.5)
+             << ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << (sorted.empty() ? 0 : sorted.back()) << "}}";
+        return json.str();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    std::string error;
+    if (options.modelFile.empty() && !prepareSynthetic(options, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    DetectionLibrary::DetectionConfigurationParameter floatParameters;
+    floatParameters.weightFile = options.modelFile;
+    floatParameters.nameFile = options.namesFile;
+    floatParameters.thresh = options.thresh;
+    floatParameters.threshHeir = options.thresh;
+    floatParameters.nms = options.nms;
+
+    DetectionLibrary::DetectionConfigurationParameter int8Parameters = floatParameters;
+    if (!options.int8ModelFile.empty())
+    {
+        int8Parameters.weightFile = options.int8ModelFile;
+    }
+    else
+    {
+        int8Parameters.calibrationDirectory = options.calibrationDirectory;
+        int8Parameters.calibrationImages = options.calibrationImages;
+    }
+
+    const DetectionLibrary::PartitionDetectionConfigurationParameter noPartitions;
+    Onnx floatDetector, int8Detector;
+    if (!floatDetector.configuration(floatParameters, noPartitions))
+    {
+        std::cerr << "Cannot load the float model " << options.modelFile << "\n";
+        return 1;
+    }
+    const auto calibrationBegin = std::chrono::steady_clock::now();
+    if (!int8Detector.configuration(int8Parameters, noPartitions))
+    {
+        std::cerr << "Cannot load or calibrate the int8 model\n";
+        return 1;
+    }
+    const double calibrationSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - calibrationBegin).count();
+
+    std::vector<cv::Mat> frames;
+    if (!loadFrames(options, frames, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    Run floatRun, int8Run;
+    if (!runModel(floatDetector, options, frames, floatRun, error) || !runModel(int8Detector, options, frames, int8Run, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    Accuracy accuracy;
+    for (size_t i = 0; i < frames.size(); i++)
+        compare(floatRun.detections[i], int8Run.detections[i], options.iou, accuracy);
+    const double recall = accuracy.floatObjects ? static_cast<double>(accuracy.matched) / accuracy.floatObjects : 1.0;
+    const double precision = accuracy.int8Objects ? static_cast<double>(accuracy.matched) / accuracy.int8Objects : 1.0;
+    const double floatMean = mean(floatRun.latencies);
+    const double int8Mean = mean(int8Run.latencies);
+    const bool passed = recall >= options.minRecall;
+
+    char timestamp[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(4)
+           << "{\n  \"timestamp\": " << Json::quote(timestamp)
+           << ",\n  \"host\": {\"hardwareThreads\": " << std::thread::hardware_concurrency()
+           << ", \"opencv\": " << Json::quote(CV_VERSION) << "}"
+           << ",\n  \"frames\": " << frames.size()
+           << ",\n  \"source\": " << Json::quote(options.imageDirectory.empty() ? "synthetic" : options.imageDirectory)
+           << ",\n  \"float\": " << modelJson(floatDetector, options.modelFile, floatRun)
+           << ",\n  \"int8\": " << modelJson(int8Detector, options.int8ModelFile.empty() ? "calibrated:" + options.calibrationDirectory : options.int8ModelFile, int8Run)
+           << ",\n  \"calibrationSeconds\": " << (options.int8ModelFile.empty() ? calibrationSeconds : 0.0)
+           << ",\n  \"speedup\": " << (int8Mean > 0 ? floatMean / int8Mean : 0)
+           << ",\n  \"accuracy\": {\"iou\": " << options.iou
+           << ", \"floatObjects\": " << accuracy.floatObjects << ", \"int8Objects\": " << accuracy.int8Objects
+           << ", \"matched\": " << accuracy.matched << ", \"recall\": " << recall << ", \"precision\": " << precision
+           << ", \"meanIou\": " << (accuracy.matched ? accuracy.iouSum / accuracy.matched : 0)
+           << ", \"meanScoreDelta\": " << (accuracy.matched ? accuracy.scoreDeltaSum / accuracy.matched : 0) << "}"
+           << ",\n  \"minRecall\": " << options.minRecall << ", \"passed\": " << (passed ? "true" : "false")
+           << "\n}\n";
+
+    if (options.outputFile.empty())
+    {
+        std::cout << report.str();
+    }
+    else
+    {
+        std::ofstream file(options.outputFile, std::ios::trunc);
+        file << report.str();
+        if (!file)
+        {
+            std::cerr << "Cannot write " << options.outputFile << "\n";
+            return 1;
+        }
+    }
+    return passed ? 0 : 1;
+}
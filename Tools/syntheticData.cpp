@@ -0,0 +1,357 @@
+#include "syntheticData.H"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    const int onnxInputSize = 640;
+    const int onnxStrides[3] = {8, 16, 32};
+    const int anchorsPerScale = 3;
+    const int hiddenFilters = 16;
+
+    /**
+     * @class ProtoWriter
+     * @brief Just enough of the protobuf wire format to write an ONNX ModelProto.
+     */
+    class ProtoWriter
+    {
+    public:
+        void varint(int field, uint64_t value)
+        {
+            key(field, 0);
+            rawVarint(value);
+        }
+        void float32(int field, float value)
+        {
+            key(field, 5);
+            char bytes[4];
+            std::memcpy(bytes, &value, sizeof(bytes));
+            data.append(bytes, sizeof(bytes));
+        }
+        void bytes(int field, const std::string &value)
+        {
+            key(field, 2);
+            rawVarint(value.size());
+            data += value;
+        }
+        void message(int field, const ProtoWriter &value) { bytes(field, value.data); }
+
+        std::string data;
+
+    private:
+        void key(int field, int wireType) { rawVarint((static_cast<uint64_t>(field) << 3) | wireType); }
+        void rawVarint(uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            data.push_back(static_cast<char>(value));
+        }
+    };
+
+    // onnx.proto field numbers and enum values used below.
+    enum
+    {
+        TensorFloat = 1,
+        TensorInt64 = 7,
+        AttributeInt = 2,
+        AttributeInts = 7
+    };
+
+    ProtoWriter intsAttribute(const std::string &name, const std::vector<int64_t> &values)
+    {
+        ProtoWriter attribute;
+        attribute.bytes(1, name);
+        for (int64_t value : values)
+            attribute.varint(8, static_cast<uint64_t>(value));
+        attribute.varint(20, AttributeInts);
+        return attribute;
+    }
+
+    ProtoWriter node(const std::string &opType, const std::vector<std::string> &inputs, const std::string &output, const std::vector<ProtoWriter> &attributes = {})
+    {
+        ProtoWriter result;
+        for (const std::string &input : inputs)
+            result.bytes(1, input);
+        result.bytes(2, output);
+        result.bytes(3, output);
+        result.bytes(4, opType);
+        for (const ProtoWriter &attribute : attributes)
+            result.message(5, attribute);
+        return result;
+    }
+
+    ProtoWriter tensor(const std::string &name, int dataType, const std::vector<int64_t> &dims, const void *data, size_t size)
+    {
+        ProtoWriter result;
+        for (int64_t dim : dims)
+            result.varint(1, static_cast<uint64_t>(dim));
+        result.varint(2, dataType);
+        result.bytes(8, name);
+        result.bytes(9, std::string(static_cast<const char *>(data), size));
+        return result;
+    }
+
+    /** @brief Tensor value info, negative dims are written as the symbolic dimension "batch". */
+    ProtoWriter valueInfo(const std::string &name, const std::vector<int64_t> &dims)
+    {
+        ProtoWriter shape;
+        for (int64_t dim : dims)
+        {
+            ProtoWriter dimension;
+            if (dim < 0)
+                dimension.bytes(2, "batch");
+            else
+                dimension.varint(1, static_cast<uint64_t>(dim));
+            shape.message(1, dimension);
+        }
+        ProtoWriter tensorType;
+        tensorType.varint(1, TensorFloat);
+        tensorType.message(2, shape);
+        ProtoWriter type;
+        type.message(1, tensorType);
+
+        ProtoWriter result;
+        result.bytes(1, name);
+        result.message(2, type);
+        return result;
+    }
+
+    std::vector<float> randomWeights(cv::RNG &rng, size_t count, float scale)
+    {
+        std::vector<float> weights(count);
+        for (float &weight : weights)
+            weight = rng.uniform(-scale, scale);
+        return weights;
+    }
+
+    bool createDirectory(const std::string &directory, std::string &error)
+    {
+        std::error_code code;
+        fs::create_directories(directory, code);
+        if (code)
+        {
+            error = "Cannot create " + directory + ": " + code.message();
+            return false;
+        }
+        return true;
+    }
+
+    bool writeFile(const std::string &path, const std::string &content, std::string &error)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(content.data(), content.size());
+        if (!file)
+        {
+            error = "Cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool writeNames(const std::string &path, int classes, std::string &error)
+    {
+        std::ostringstream names;
+        for (int i = 0; i < classes; i++)
+            names << "class" << i << "\n";
+        return writeFile(path, names.str(), error);
+    }
+
+    void appendFloats(std::string &data, const std::vector<float> &values)
+    {
+        data.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(float));
+    }
+}
+
+bool SyntheticData::writeDarknetModel(const std::string &directory, const ModelParameters &model, DetectionLibrary::DetectionConfigurationParameter &parameters, std::string &error)
+{
+    if (model.classes <= 0 || model.inputSize <= 0 || model.inputSize % 32 != 0)
+    {
+        error = "Synthetic darknet model needs classes > 0 and an input size that is a multiple of 32.";
+        return false;
+    }
+    if (!createDirectory(directory, error))
+        return false;
+
+    const int outputFilters = anchorsPerScale * (model.classes + 5);
+    std::ostringstream cfg;
+    cfg << "[net]\nbatch=1\nsubdivisions=1\nwidth=" << model.inputSize << "\nheight=" << model.inputSize << "\nchannels=3\n\n"
+        << "[convolutional]\nbatch_normalize=0\nfilters=" << hiddenFilters << "\nsize=3\nstride=2\npad=1\nactivation=leaky\n\n"
+        << "[maxpool]\nsize=2\nstride=2\n\n"
+        << "[convolutional]\nbatch_normalize=0\nfilters=" << outputFilters << "\nsize=1\nstride=1\npad=1\nactivation=linear\n\n"
+        << "[yolo]\nmask=0,1,2\nanchors=10,14, 23,27, 37,58\nclasses=" << model.classes
+        << "\nnum=3\njitter=.3\nignore_thresh=.7\ntruth_thresh=1\n";
+
+    // Header: major, minor, revision, then a 64-bit "seen" counter since version 0.2.
+    std::string weights;
+    const int32_t version[3] = {0, 2, 5};
+    const uint64_t seen = 0;
+    weights.append(reinterpret_cast<const char *>(version), sizeof(version));
+    weights.append(reinterpret_cast<const char *>(&seen), sizeof(seen));
+
+    // Convolutions without batch normalisation store biases, then weights.
+    cv::RNG rng(model.seed);
+    appendFloats(weights, randomWeights(rng, hiddenFilters, 0.1f));
+    appendFloats(weights, randomWeights(rng, hiddenFilters * 3 * 3 * 3, 0.5f));
+    std::vector<float> biases = randomWeights(rng, outputFilters, 0.5f);
+    for (int anchor = 0; anchor < anchorsPerScale; anchor++)
+        biases[anchor * (model.classes + 5) + 4] += model.objectBias;
+    appendFloats(weights, biases);
+    appendFloats(weights, randomWeights(rng, outputFilters * hiddenFilters, 0.5f));
+
+    parameters.cfgFile = (fs::path(directory) / "synthetic.cfg").string();
+    parameters.weightFile = (fs::path(directory) / "synthetic.weights").string();
+    parameters.nameFile = (fs::path(directory) / "synthetic.names").string();
+    return writeFile(parameters.cfgFile, cfg.str(), error) &&
+           writeFile(parameters.weightFile, weights, error) &&
+           writeNames(parameters.nameFile, model.classes, error);
+}
+
+bool SyntheticData::writeOnnxModel(const std::string &directory, const ModelParameters &model, DetectionLibrary::DetectionConfigurationParameter &parameters, std::string &error)
+{
+    if (model.classes <= 0)
+    {
+        error = "Synthetic ONNX model needs classes > 0.";
+        return false;
+    }
+    if (!createDirectory(directory, error))
+        return false;
+
+    // Per stride: AveragePool (stride) -> 1x1 Conv -> Reshape [-1, 3, C + 5, G, G] -> Transpose [1, 3, G, G, C + 5].
+    // The batch stays dynamic so the model can be calibrated on a batch of images.
+    const int64_t fields = model.classes + 5;
+    const int64_t outputChannels = anchorsPerScale * fields;
+    cv::RNG rng(model.seed);
+    ProtoWriter graph;
+    std::vector<ProtoWriter> initializers;
+    std::vector<ProtoWriter> outputs;
+    for (int scale = 0; scale < 3; scale++)
+    {
+        const int64_t stride = onnxStrides[scale];
+        const int64_t grid = onnxInputSize / stride;
+        const std::string suffix = std::to_string(stride);
+        const std::string output = "output" + std::to_string(scale); // OpenCV lists the outputs sorted by name.
+
+        graph.message(1, node("AveragePool", {"images"}, "pool" + suffix,
+                              {intsAttribute("kernel_shape", {stride, stride}), intsAttribute("strides", {stride, stride})}));
+        graph.message(1, node("Conv", {"pool" + suffix, "weight" + suffix, "bias" + suffix}, "conv" + suffix,
+                              {intsAttribute("kernel_shape", {1, 1})}));
+        graph.message(1, node("Reshape", {"conv" + suffix, "shape" + suffix}, "reshape" + suffix));
+        graph.message(1, node("Transpose", {"reshape" + suffix}, output, {intsAttribute("perm", {0, 1, 3, 4, 2})}));
+
+        const std::vector<float> weight = randomWeights(rng, outputChannels * 3, 4.f);
+        std::vector<float> bias = randomWeights(rng, outputChannels, 1.f);
+        for (int anchor = 0; anchor < anchorsPerScale; anchor++)
+            bias[anchor * fields + 4] += model.objectBias;
+        const int64_t shape[5] = {-1, anchorsPerScale, fields, grid, grid};
+
+        initializers.push_back(tensor("weight" + suffix, TensorFloat, {outputChannels, 3, 1, 1}, weight.data(), weight.size() * sizeof(float)));
+        initializers.push_back(tensor("bias" + suffix, TensorFloat, {outputChannels}, bias.data(), bias.size() * sizeof(float)));
+        initializers.push_back(tensor("shape" + suffix, TensorInt64, {5}, shape, sizeof(shape)));
+        outputs.push_back(valueInfo(output, {1, anchorsPerScale, grid, grid, fields}));
+    }
+    graph.bytes(2, "synthetic");
+    for (const ProtoWriter &initializer : initializers)
+        graph.message(5, initializer);
+    graph.message(11, valueInfo("images", {-1, 3, onnxInputSize, onnxInputSize}));
+    for (const ProtoWriter &output : outputs)
+        graph.message(12, output);
+
+    ProtoWriter opset;
+    opset.bytes(1, "");
+    opset.varint(2, 12);
+    ProtoWriter modelProto;
+    modelProto.varint(1, 7); // IR version 7
+    modelProto.bytes(2, "netravision-synthetic");
+    modelProto.message(7, graph);
+    modelProto.message(8, opset);
+
+    parameters.weightFile = (fs::path(directory) / "synthetic.onnx").string();
+    parameters.nameFile = (fs::path(directory) / "synthetic.names").string();
+    return writeFile(parameters.weightFile, modelProto.data, error) &&
+           writeNames(parameters.nameFile, model.classes, error);
+}
+
+void SyntheticData::frames(const cv::Size &size, int count, unsigned seed, std::vector<cv::Mat> &frames)
+{
+    struct Shape
+    {
+        cv::Point2f centre;
+        cv::Point2f velocity;
+        cv::Size axes;
+        cv::Scalar color;
+        bool ellipse;
+    };
+
+    cv::RNG rng(seed);
+    cv::Mat background(size, CV_8UC3);
+    rng.fill(background, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(60));
+
+    const int shortSide = std::min(size.width, size.height);
+    std::vector<Shape> shapes(6);
+    for (Shape &shape : shapes)
+    {
+        // One draw per statement: the evaluation order of constructor arguments is unspecified,
+        // so draws inside one call would give compiler-dependent frames.
+        const float centreX = rng.uniform(0.15f, 0.85f) * size.width;
+        const float centreY = rng.uniform(0.15f, 0.85f) * size.height;
+        const float velocityX = rng.uniform(-0.01f, 0.01f) * size.width;
+        const float velocityY = rng.uniform(-0.01f, 0.01f) * size.height;
+        const int axisX = rng.uniform(shortSide / 20, shortSide / 8 + 1);
+        const int axisY = rng.uniform(shortSide / 20, shortSide / 8 + 1);
+        shape.centre = cv::Point2f(centreX, centreY);
+        shape.velocity = cv::Point2f(velocityX, velocityY);
+        shape.axes = cv::Size(axisX, axisY);
+        shape.ellipse = rng.uniform(0, 2) == 1;
+
+        // The color detectors convert with COLOR_RGB2HSV_FULL, so build the bytes from the hue they will see.
+        cv::Mat hsv(1, 1, CV_8UC3, cv::Scalar(rng.uniform(0, 256), 210, 220));
+        cv::Mat pixel;
+        cv::cvtColor(hsv, pixel, cv::COLOR_HSV2RGB_FULL);
+        const cv::Vec3b bytes = pixel.at<cv::Vec3b>(0, 0);
+        shape.color = cv::Scalar(bytes[0], bytes[1], bytes[2]);
+    }
+
+    frames.clear();
+    for (int i = 0; i < count; i++)
+    {
+        cv::Mat frame = background.clone();
+        for (Shape &shape : shapes)
+        {
+            if (shape.ellipse)
+                cv::ellipse(frame, cv::Point(shape.centre), shape.axes, 0, 0, 360, shape.color, cv::FILLED);
+            else
+                cv::rectangle(frame, cv::Rect(cv::Point(shape.centre) - cv::Point(shape.axes.width, shape.axes.height), shape.axes * 2), shape.color, cv::FILLED);
+
+            shape.centre += shape.velocity;
+            if (shape.centre.x < 0 || shape.centre.x >= size.width)
+                shape.velocity.x = -shape.velocity.x;
+            if (shape.centre.y < 0 || shape.centre.y >= size.height)
+                shape.velocity.y = -shape.velocity.y;
+        }
+        frames.push_back(frame);
+    }
+}
+
+std::vector<DetectionLibrary::ColorRange> SyntheticData::colorRanges(int count)
+{
+    std::vector<DetectionLibrary::ColorRange> ranges;
+    count = std::max(count, 1);
+    for (int band = 0; band < count; band++)
+    {
+        DetectionLibrary::ColorRange range;
+        range.lowChannel1 = band * 256 / count;
+        range.highChannel1 = (band + 1) * 256 / count - 1;
+        range.lowChannel2 = 100;
+        range.highChannel2 = 255;
+        range.lowChannel3 = 100;
+        range.highChannel3 = 255;
+        ranges.push_back(range);
+    }
+    return ranges;
+}
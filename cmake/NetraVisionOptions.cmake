@@ -0,0 +1,96 @@
+# Optimization, CPU level, profile and sanitizer settings shared by all NetraVision targets.
+#
+#   NETRAVISION_ENABLE_LTO   link time optimization in the optimized build types
+#   NETRAVISION_ARCH         CPU level passed to -march (x86-64-v2, x86-64-v3, x86-64-v4, native, ...)
+#   NETRAVISION_PGO          OFF, GENERATE (instrumented build) or USE (optimize with the collected profile)
+#   NETRAVISION_PGO_DIR      where GENERATE writes and USE reads the profile
+#   NETRAVISION_SANITIZE     sanitizers, e.g. "address;undefined" or "thread"
+
+include(CheckCXXCompilerFlag)
+include(CheckIPOSupported)
+
+set(NETRAVISION_COMPILE_OPTIONS)
+set(NETRAVISION_LINK_OPTIONS)
+
+# Link time optimization.
+set(NETRAVISION_LTO_ACTIVE OFF)
+if(NETRAVISION_ENABLE_LTO)
+    check_ipo_supported(RESULT lto_supported OUTPUT lto_output LANGUAGES CXX)
+    if(lto_supported)
+        set(NETRAVISION_LTO_ACTIVE ON)
+    else()
+        message(WARNING "LTO requested but not supported by the toolchain: ${lto_output}")
+    endif()
+endif()
+
+# CPU level. Everything is compiled for one level; build once per level to ship several.
+if(NETRAVISION_ARCH)
+    set(arch_flag "-march=${NETRAVISION_ARCH}")
+    string(MAKE_C_IDENTIFIER "NETRAVISION_HAS_MARCH_${NETRAVISION_ARCH}" arch_check)
+    check_cxx_compiler_flag("${arch_flag}" ${arch_check})
+    if(NOT ${arch_check})
+        message(FATAL_ERROR "The compiler does not accept ${arch_flag}")
+    endif()
+    list(APPEND NETRAVISION_COMPILE_OPTIONS ${arch_flag})
+    list(APPEND NETRAVISION_LINK_OPTIONS ${arch_flag})
+endif()
+
+# Profile guided optimization.
+string(TOUPPER "${NETRAVISION_PGO}" pgo_mode)
+if(pgo_mode STREQUAL "GENERATE")
+    file(MAKE_DIRECTORY "${NETRAVISION_PGO_DIR}")
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+        set(pgo_flags "-fprofile-instr-generate=${NETRAVISION_PGO_DIR}/%p.profraw")
+    else()
+        # The detection and saving threads update the counters concurrently.
+        set(pgo_flags "-fprofile-generate=${NETRAVISION_PGO_DIR}" -fprofile-update=atomic)
+    endif()
+    list(APPEND NETRAVISION_COMPILE_OPTIONS ${pgo_flags})
+    list(APPEND NETRAVISION_LINK_OPTIONS ${pgo_flags})
+elseif(pgo_mode STREQUAL "USE")
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+        # Merge the raw profiles first: llvm-profdata merge -o default.profdata *.profraw
+        set(pgo_flags "-fprofile-instr-use=${NETRAVISION_PGO_DIR}/default.profdata" -Wno-profile-instr-unprofiled)
+    else()
+        set(pgo_flags "-fprofile-use=${NETRAVISION_PGO_DIR}" -fprofile-correction -Wno-missing-profile)
+    endif()
+    list(APPEND NETRAVISION_COMPILE_OPTIONS ${pgo_flags})
+    list(APPEND NETRAVISION_LINK_OPTIONS ${pgo_flags})
+elseif(NOT pgo_mode STREQUAL "OFF" AND NOT pgo_mode STREQUAL "")
+    message(FATAL_ERROR "NETRAVISION_PGO must be OFF, GENERATE or USE, not ${NETRAVISION_PGO}")
+endif()
+
+# Sanitizers.
+if(NETRAVISION_SANITIZE)
+    string(REPLACE "," ";" sanitizers "${NETRAVISION_SANITIZE}")
+    if("thread" IN_LIST sanitizers AND ("address" IN_LIST sanitizers OR "leak" IN_LIST sanitizers))
+        message(FATAL_ERROR "The thread sanitizer cannot be combined with address or leak")
+    endif()
+    list(JOIN sanitizers "," sanitizer_list)
+    list(APPEND NETRAVISION_COMPILE_OPTIONS "-fsanitize=${sanitizer_list}" -fno-omit-frame-pointer -g)
+    list(APPEND NETRAVISION_LINK_OPTIONS "-fsanitize=${sanitizer_list}")
+    if("undefined" IN_LIST sanitizers)
+        list(APPEND NETRAVISION_COMPILE_OPTIONS -fno-sanitize-recover=undefined)
+    endif()
+endif()
+
+# Apply the settings to a target. HOT targets (the detection and pipeline code) are built
+# with -O3 in every optimized build type, RelWithDebInfo included.
+function(netravision_target_options target)
+    cmake_parse_arguments(ARG "HOT" "" "" ${ARGN})
+
+    target_compile_options(${target} PRIVATE -Wall -Werror=return-type ${NETRAVISION_COMPILE_OPTIONS})
+    target_link_options(${target} PRIVATE ${NETRAVISION_LINK_OPTIONS})
+    if(NETRAVISION_WARNINGS_AS_ERRORS)
+        target_compile_options(${target} PRIVATE -Werror)
+    endif()
+    if(ARG_HOT)
+        target_compile_options(${target} PRIVATE $<$<OR:$<CONFIG:Release>,$<CONFIG:RelWithDebInfo>>:-O3>)
+    endif()
+    if(NETRAVISION_LTO_ACTIVE)
+        set_target_properties(${target} PROPERTIES
+            INTERPROCEDURAL_OPTIMIZATION_RELEASE ON
+            INTERPROCEDURAL_OPTIMIZATION_RELWITHDEBINFO ON
+            INTERPROCEDURAL_OPTIMIZATION_MINSIZEREL ON)
+    endif()
+endfunction()